@@ -3,6 +3,8 @@ const std = @import("std");
 pub fn build(b: *std.Build) void {
     const target = b.standardTargetOptions(.{});
     const strip = b.option(bool, "strip", "Whether to strip symbols from the binary, defaults to true") orelse true;
+    const zlib = b.option(bool, "zlib", "Read gzip-compressed input, defaults to false") orelse false;
+    const zstd = b.option(bool, "zstd", "Read zstd-compressed input, defaults to false") orelse false;
 
     const bin = b.addExecutable(.{
         .name = "vac-enc",
@@ -19,21 +21,50 @@ pub fn build(b: *std.Build) void {
 
     bin.addCSourceFiles(.{
         .files = &.{
+            "src/aiffreader.c",
+            "src/cafreader.c",
+            "src/convert.c",
             "src/decode.c",
+            "src/decompress.c",
+            "src/downmix.c",
             "src/flac.c",
             "src/main.c",
+            "src/mix.c",
+            "src/opusreader.c",
+            "src/pool.c",
+            "src/preview.c",
+            "src/resample.c",
+            "src/ring.c",
+            "src/shmreader.c",
+            "src/tar.c",
             "src/unicode_support.c",
             "src/wavreader.c",
         },
         .flags = &.{
             "-std=c99",
             "-D_POSIX_C_SOURCE=200809L",
+            "-D_FILE_OFFSET_BITS=64",
         },
     });
 
     bin.linkSystemLibrary("libopusenc");
     bin.linkSystemLibrary("opus");
     bin.linkSystemLibrary("soxr");
+    if (zlib) {
+        bin.root_module.addCMacro("HAVE_ZLIB", "1");
+        bin.linkSystemLibrary("zlib");
+    }
+    if (zstd) {
+        bin.root_module.addCMacro("HAVE_ZSTD", "1");
+        bin.linkSystemLibrary("libzstd");
+    }
+    if (target.result.os.tag != .windows) {
+        bin.linkSystemLibrary("pthread");
+        bin.linkSystemLibrary("m");
+    }
+    if (target.result.os.tag == .linux) {
+        bin.linkSystemLibrary("rt"); // shm_open() on older glibc
+    }
 
     b.installArtifact(bin);
 }
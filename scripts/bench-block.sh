@@ -0,0 +1,37 @@
+#!/bin/bash
+
+# Encodes one input with each --block setting and prints the best wall time,
+# the encode time --startup-stats reports for that run, and peak memory.
+# Needs GNU time at /usr/bin/time.
+
+if [ $# -lt 1 ]; then
+    echo "Usage: ./bench-block.sh [input] [runs] [block settings...]"
+    echo "       e.g. ./bench-block.sh bed-96k.wav 7 default auto 20ms 2048"
+    exit 1
+fi
+
+in=$1
+runs=${2:-7}
+shift 2 2>/dev/null
+blocks=${@:-default auto 20ms}
+vac=${VAC_ENC:-vac-enc}
+
+out=$(mktemp --suffix=.opus)
+trap 'rm -f "$out"' EXIT
+
+printf "%-10s %10s %12s %10s\n" "block" "wall s" "encode ms" "peak MB"
+for b in $blocks; do
+    opt=""
+    [ "$b" != "default" ] && opt="--block $b"
+    best=""
+    for i in $(seq "$runs"); do
+        log=$(/usr/bin/time -f "time %e %M" "$vac" -j 1 $opt --startup-stats "$in" "$out" 2>&1 | tr '\t\r' '\n\n')
+        wall=$(echo "$log" | awk '/^time / { print $2 }')
+        rss=$(echo "$log" | awk '/^time / { printf "%.1f", $3/1024 }')
+        enc=$(echo "$log" | awk '/encode/ { for (i = 1; i < NF; i++) if ($i == "encode") print $(i+1) }')
+        if [ -z "$best" ] || awk "BEGIN { exit !($wall < $best) }"; then
+            best=$wall; best_enc=$enc; best_rss=$rss
+        fi
+    done
+    printf "%-10s %10s %12s %10s\n" "$b" "$best" "$best_enc" "$best_rss"
+done
@@ -0,0 +1,206 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aiffreader.h"
+#include "unicode_support_wrapper.h"
+
+#define TAG(a, b, c, d) (((uint32_t)(a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+
+struct aiff_reader {
+    FILE *aiff;
+    uint32_t data_length;
+
+    int format;
+    int sample_rate;
+    int bits_per_sample;
+    int channels;
+    int big_endian;
+};
+
+static uint32_t be32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static int skip(FILE *f, uint32_t n, int seekable)
+{
+    unsigned char buf[4096];
+
+    if (seekable)
+        return fseek_64(f, n, SEEK_CUR);
+    while (n) {
+        size_t len = n < sizeof(buf) ? n : sizeof(buf);
+        if (fread(buf, 1, len, f) != len)
+            return -1;
+        n -= len;
+    }
+    return 0;
+}
+
+// 80-bit IEEE 754 extended precision, only whole rates are meaningful here
+static int read_extended(const unsigned char *p)
+{
+    int exponent = ((p[0] & 0x7f) << 8 | p[1]) - 16383 - 31;
+    uint32_t mantissa = be32(p+2);
+
+    if (p[0] & 0x80 || exponent > 0 || exponent < -31)
+        return 0;
+    return mantissa >> -exponent;
+}
+
+static int parse_comm(struct aiff_reader *ar, const unsigned char *c, uint32_t len, int aifc)
+{
+    uint32_t compression = TAG('N', 'O', 'N', 'E');
+
+    if (len < 18 || (aifc && len < 22))
+        return 0;
+    ar->channels        = c[0] << 8 | c[1];
+    ar->bits_per_sample = c[6] << 8 | c[7];
+    ar->sample_rate     = read_extended(c+8);
+    if (aifc)
+        compression = be32(c+18);
+
+    ar->format     = 1;
+    ar->big_endian = 1;
+    switch (compression) {
+        case TAG('N', 'O', 'N', 'E'):
+        case TAG('t', 'w', 'o', 's'):
+            break;
+        case TAG('i', 'n', '2', '4'):
+            ar->bits_per_sample = 24;
+            break;
+        case TAG('i', 'n', '3', '2'):
+            ar->bits_per_sample = 32;
+            break;
+        case TAG('s', 'o', 'w', 't'):
+            ar->big_endian = ar->bits_per_sample == 8;
+            break;
+        case TAG('f', 'l', '3', '2'):
+        case TAG('F', 'L', '3', '2'):
+            ar->format          = 3;
+            ar->bits_per_sample = 32;
+            break;
+        case TAG('f', 'l', '6', '4'):
+        case TAG('F', 'L', '6', '4'):
+            ar->format          = 3;
+            ar->bits_per_sample = 64;
+            break;
+        default: // Compressed
+            ar->format = 0;
+            break;
+    }
+    // Samples are stored in whole bytes
+    ar->bits_per_sample = (ar->bits_per_sample + 7) & ~7;
+
+    return 1;
+}
+
+void *aiff_read_open(FILE *aiff)
+{
+    struct aiff_reader *ar = malloc(sizeof(*ar));
+    unsigned char hdr[12];
+    int64_t data_pos = -1;
+    int seekable, aifc, have_comm = 0;
+
+    if (!ar)
+        return NULL;
+    memset(ar, 0, sizeof(*ar));
+    ar->aiff = aiff;
+    seekable = ftell_64(aiff) >= 0;
+
+    if (fread(hdr, 1, 12, aiff) != 12 || be32(hdr) != TAG('F', 'O', 'R', 'M') ||
+        (be32(hdr+8) != TAG('A', 'I', 'F', 'F') && be32(hdr+8) != TAG('A', 'I', 'F', 'C')))
+        return ar;
+    aifc = be32(hdr+8) == TAG('A', 'I', 'F', 'C');
+
+    while (fread(hdr, 1, 8, aiff) == 8) {
+        uint32_t tag = be32(hdr), len = be32(hdr+4);
+        uint32_t pad = len & 1; // Chunks are aligned to two bytes
+
+        if (tag == TAG('C', 'O', 'M', 'M')) {
+            unsigned char comm[64];
+            uint32_t n = len < sizeof(comm) ? len : sizeof(comm);
+            if (fread(comm, 1, n, aiff) != n || !parse_comm(ar, comm, len, aifc) ||
+                skip(aiff, len-n+pad, seekable))
+                break;
+            have_comm = 1;
+        } else if (tag == TAG('S', 'S', 'N', 'D')) {
+            unsigned char ssnd[8];
+            if (len < 8 || fread(ssnd, 1, 8, aiff) != 8 || be32(ssnd) > len-8 ||
+                skip(aiff, be32(ssnd), seekable))
+                break;
+            ar->data_length = len - 8 - be32(ssnd);
+            if (!seekable || have_comm) // Start decoding right here
+                return ar;
+            data_pos = ftell_64(aiff);
+            if (skip(aiff, ar->data_length+pad, seekable))
+                break;
+        } else if (skip(aiff, len+pad, seekable)) {
+            break;
+        }
+        if (have_comm && data_pos >= 0)
+            break;
+    }
+    if (data_pos >= 0)
+        fseek_64(aiff, data_pos, SEEK_SET);
+    else
+        ar->format = 0;
+
+    return ar;
+}
+
+void aiff_read_close(void *obj)
+{
+    struct aiff_reader *ar = obj;
+
+    if (ar->aiff != stdin)
+        fclose(ar->aiff);
+    free(ar);
+}
+
+int aiff_get_header(void *obj, int *format, int *channels, int *sample_rate,
+                    int *bits_per_sample, int *big_endian, uint64_t *data_length)
+{
+    struct aiff_reader *ar = obj;
+
+    *format          = ar->format;
+    *channels        = ar->channels;
+    *sample_rate     = ar->sample_rate;
+    *bits_per_sample = ar->bits_per_sample;
+    *big_endian      = ar->big_endian;
+    *data_length     = ar->data_length;
+
+    return ar->format && ar->sample_rate;
+}
+
+int aiff_read_data(void *obj, unsigned char *data, unsigned int length)
+{
+    struct aiff_reader *ar = obj;
+    size_t n;
+
+    if (length > ar->data_length)
+        length = ar->data_length;
+    n = fread(data, 1, length, ar->aiff);
+    ar->data_length -= n;
+
+    return n;
+}
@@ -0,0 +1,178 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cafreader.h"
+#include "unicode_support_wrapper.h"
+
+#define TAG(a, b, c, d) (((uint32_t)(a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+
+#define CAF_FLAG_FLOAT         1
+#define CAF_FLAG_LITTLE_ENDIAN 2
+
+struct caf_reader {
+    FILE *caf;
+    uint64_t data_length;
+
+    int format;
+    int sample_rate;
+    int bits_per_sample;
+    int channels;
+    int big_endian;
+
+    int streamed;
+};
+
+static uint32_t be32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint64_t be64(const unsigned char *p)
+{
+    return (uint64_t)be32(p) << 32 | be32(p+4);
+}
+
+static int skip(FILE *f, uint64_t n, int seekable)
+{
+    unsigned char buf[4096];
+
+    if (seekable)
+        return n > INT64_MAX ? -1 : fseek_64(f, (int64_t)n, SEEK_CUR);
+    while (n) {
+        size_t len = n < sizeof(buf) ? n : sizeof(buf);
+        if (fread(buf, 1, len, f) != len)
+            return -1;
+        n -= len;
+    }
+    return 0;
+}
+
+static void parse_desc(struct caf_reader *cr, const unsigned char *d)
+{
+    uint64_t rate_bits = be64(d);
+    uint32_t flags = be32(d+12), bytes_per_packet = be32(d+16);
+    uint32_t frames_per_packet = be32(d+20), bits = be32(d+28);
+    double rate;
+
+    memcpy(&rate, &rate_bits, sizeof(rate));
+    cr->sample_rate     = (int)rate;
+    cr->channels        = be32(d+24);
+    cr->bits_per_sample = bits;
+    cr->format          = flags & CAF_FLAG_FLOAT ? 3 : 1;
+    cr->big_endian      = !(flags & CAF_FLAG_LITTLE_ENDIAN) || bits == 8;
+
+    // Only packed LPCM, one frame per packet
+    if (be32(d+8) != TAG('l', 'p', 'c', 'm') || frames_per_packet != 1 ||
+        !cr->channels || bits % 8 || bytes_per_packet != cr->channels*bits/8)
+        cr->format = 0;
+}
+
+void *caf_read_open(FILE *caf)
+{
+    struct caf_reader *cr = malloc(sizeof(*cr));
+    unsigned char hdr[12];
+    int64_t data_pos = -1;
+    int seekable, have_desc = 0;
+
+    if (!cr)
+        return NULL;
+    memset(cr, 0, sizeof(*cr));
+    cr->caf = caf;
+    seekable = ftell_64(caf) >= 0;
+
+    if (fread(hdr, 1, 8, caf) != 8 || be32(hdr) != TAG('c', 'a', 'f', 'f'))
+        return cr;
+
+    while (fread(hdr, 1, 12, caf) == 12) {
+        uint32_t tag = be32(hdr);
+        uint64_t len = be64(hdr+4);
+
+        if (tag == TAG('d', 'e', 's', 'c')) {
+            unsigned char desc[32];
+            if (len < sizeof(desc) || fread(desc, 1, sizeof(desc), caf) != sizeof(desc) ||
+                skip(caf, len-sizeof(desc), seekable))
+                break;
+            parse_desc(cr, desc);
+            have_desc = 1;
+        } else if (tag == TAG('d', 'a', 't', 'a')) {
+            unsigned char edit_count[4];
+            if (fread(edit_count, 1, 4, caf) != 4)
+                break;
+            if (len == UINT64_MAX || !len) // Still being written, read until EOF
+                cr->streamed = 1;
+            else
+                cr->data_length = len - 4;
+            if (!seekable || have_desc || cr->streamed) // Start decoding right here
+                return cr;
+            data_pos = ftell_64(caf);
+            if (skip(caf, cr->data_length, seekable))
+                break;
+        } else if (skip(caf, len, seekable)) {
+            break;
+        }
+        if (have_desc && data_pos >= 0)
+            break;
+    }
+    if (data_pos >= 0)
+        fseek_64(caf, data_pos, SEEK_SET);
+    else
+        cr->format = 0;
+
+    return cr;
+}
+
+void caf_read_close(void *obj)
+{
+    struct caf_reader *cr = obj;
+
+    if (cr->caf != stdin)
+        fclose(cr->caf);
+    free(cr);
+}
+
+int caf_get_header(void *obj, int *format, int *channels, int *sample_rate,
+                   int *bits_per_sample, int *big_endian, uint64_t *data_length)
+{
+    struct caf_reader *cr = obj;
+
+    *format          = cr->format;
+    *channels        = cr->channels;
+    *sample_rate     = cr->sample_rate;
+    *bits_per_sample = cr->bits_per_sample;
+    *big_endian      = cr->big_endian;
+    *data_length     = cr->streamed ? 0 : cr->data_length;
+
+    return cr->format && cr->sample_rate;
+}
+
+int caf_read_data(void *obj, unsigned char *data, unsigned int length)
+{
+    struct caf_reader *cr = obj;
+    size_t n;
+
+    if (length > cr->data_length && !cr->streamed)
+        length = cr->data_length;
+    n = fread(data, 1, length, cr->caf);
+    cr->data_length -= n;
+
+    return n;
+}
@@ -0,0 +1,33 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VAC_CAFREADER_H
+#define VAC_CAFREADER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+void *caf_read_open(FILE *caf);
+void caf_read_close(void *obj);
+
+// big_endian is also set for 8-bit input, as CAF stores those samples signed
+int caf_get_header(void *obj, int *format, int *channels, int *sample_rate,
+                   int *bits_per_sample, int *big_endian, uint64_t *data_length);
+int caf_read_data(void *obj, unsigned char *data, unsigned int length);
+
+#endif
@@ -0,0 +1,376 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "convert.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define VAC_X86 1
+# include <immintrin.h>
+#endif
+
+void (*vac_swap16)(void *buf, size_t n);
+void (*vac_swap32)(void *buf, size_t n);
+void (*vac_swap64)(void *buf, size_t n);
+void (*vac_s8_to_s16)(int16_t *dst, const uint8_t *src, size_t n);
+void (*vac_u8_to_s16)(int16_t *dst, const uint8_t *src, size_t n);
+void (*vac_s24le_to_s32)(int32_t *dst, const uint8_t *src, size_t n);
+void (*vac_s24be_to_s32)(int32_t *dst, const uint8_t *src, size_t n);
+void (*vac_lut8_to_f32)(float *dst, const uint8_t *src, size_t n, const float *lut);
+void (*vac_f64_to_f32)(float *dst, const double *src, size_t n);
+void (*vac_s32_to_f32)(float *dst, const int32_t *src, size_t n);
+void (*vac_s16_to_f32)(float *dst, const int16_t *src, size_t n);
+
+static float alaw_table[256];
+static float ulaw_table[256];
+
+static void swap16_c(void *buf, size_t n)
+{
+    uint16_t *p = buf;
+
+    for (size_t i = 0; i < n; i++)
+        p[i] = (uint16_t)(p[i] << 8 | p[i] >> 8);
+}
+
+static void swap32_c(void *buf, size_t n)
+{
+    uint32_t *p = buf;
+
+    for (size_t i = 0; i < n; i++)
+        p[i] = p[i] << 24 | (p[i] << 8 & 0xff0000) | (p[i] >> 8 & 0xff00) | p[i] >> 24;
+}
+
+static void swap64_c(void *buf, size_t n)
+{
+    uint32_t *p = buf;
+
+    for (size_t i = 0; i < n; i++) {
+        uint32_t lo = p[2*i], hi = p[2*i+1];
+        p[2*i]   = hi << 24 | (hi << 8 & 0xff0000) | (hi >> 8 & 0xff00) | hi >> 24;
+        p[2*i+1] = lo << 24 | (lo << 8 & 0xff0000) | (lo >> 8 & 0xff00) | lo >> 24;
+    }
+}
+
+static void s8_to_s16_c(int16_t *dst, const uint8_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        dst[i] = (int16_t)(src[i] << 8);
+}
+
+static void u8_to_s16_c(int16_t *dst, const uint8_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        dst[i] = (int16_t)((src[i] ^ 0x80) << 8);
+}
+
+static void s24le_to_s32_c(int32_t *dst, const uint8_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++, src += 3)
+        dst[i] = (int32_t)((uint32_t)src[2] << 24 | src[1] << 16 | src[0] << 8);
+}
+
+static void s24be_to_s32_c(int32_t *dst, const uint8_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++, src += 3)
+        dst[i] = (int32_t)((uint32_t)src[0] << 24 | src[1] << 16 | src[2] << 8);
+}
+
+static void lut8_to_f32_c(float *dst, const uint8_t *src, size_t n, const float *lut)
+{
+    for (size_t i = 0; i < n; i++)
+        dst[i] = lut[src[i]];
+}
+
+static void f64_to_f32_c(float *dst, const double *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        dst[i] = (float)src[i];
+}
+
+static void s32_to_f32_c(float *dst, const int32_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        dst[i] = src[i] * (1.0f/2147483648.0f);
+}
+
+static void s16_to_f32_c(float *dst, const int16_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        dst[i] = src[i] * (1.0f/32768.0f);
+}
+
+// G.711 expansion as in ITU-T G.191, scaled to the 16-bit range
+static void init_g711_tables(void)
+{
+    for (int i = 0; i < 256; i++) {
+        int a = i ^ 0x55, u = ~i & 0xff;
+        int seg = (a & 0x70) >> 4;
+        int t = (a & 0x0f) << 4;
+
+        t = seg ? (t + 0x108) << (seg - 1) : t + 8;
+        alaw_table[i] = (a & 0x80 ? t : -t) / 32768.0f;
+
+        t = (((u & 0x0f) << 3) + 0x84) << ((u & 0x70) >> 4);
+        ulaw_table[i] = (u & 0x80 ? 0x84 - t : t - 0x84) / 32768.0f;
+    }
+}
+
+const float *vac_g711_table(int format)
+{
+    return format == 6 ? alaw_table : ulaw_table;
+}
+
+#ifdef VAC_X86
+
+__attribute__((target("ssse3")))
+static void swap_ssse3(void *buf, size_t n, __m128i mask, void (*tail)(void *, size_t), size_t width)
+{
+    uint8_t *p = buf;
+    size_t i = 0;
+
+    for (; i + 16/width <= n; i += 16/width) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p+i*width));
+        _mm_storeu_si128((__m128i *)(p+i*width), _mm_shuffle_epi8(v, mask));
+    }
+    tail(p+i*width, n-i);
+}
+
+__attribute__((target("ssse3")))
+static void swap16_ssse3(void *buf, size_t n)
+{
+    swap_ssse3(buf, n, _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14),
+               &swap16_c, 2);
+}
+
+__attribute__((target("ssse3")))
+static void swap32_ssse3(void *buf, size_t n)
+{
+    swap_ssse3(buf, n, _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12),
+               &swap32_c, 4);
+}
+
+__attribute__((target("ssse3")))
+static void swap64_ssse3(void *buf, size_t n)
+{
+    swap_ssse3(buf, n, _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8),
+               &swap64_c, 8);
+}
+
+__attribute__((target("sse2")))
+static void s8_to_s16_sse2(int16_t *dst, const uint8_t *src, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src+i));
+        _mm_storeu_si128((__m128i *)(dst+i),   _mm_unpacklo_epi8(zero, v));
+        _mm_storeu_si128((__m128i *)(dst+i+8), _mm_unpackhi_epi8(zero, v));
+    }
+    s8_to_s16_c(dst+i, src+i, n-i);
+}
+
+__attribute__((target("sse2")))
+static void u8_to_s16_sse2(int16_t *dst, const uint8_t *src, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128(), sign = _mm_set1_epi8(-128);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(src+i)), sign);
+        _mm_storeu_si128((__m128i *)(dst+i),   _mm_unpacklo_epi8(zero, v));
+        _mm_storeu_si128((__m128i *)(dst+i+8), _mm_unpackhi_epi8(zero, v));
+    }
+    u8_to_s16_c(dst+i, src+i, n-i);
+}
+
+// Each 16-byte load covers four 24-bit samples plus four bytes that are not used
+__attribute__((target("ssse3")))
+static void s24le_to_s32_ssse3(int32_t *dst, const uint8_t *src, size_t n)
+{
+    const __m128i mask = _mm_setr_epi8(-128, 0, 1, 2, -128, 3, 4, 5,
+                                       -128, 6, 7, 8, -128, 9, 10, 11);
+    size_t i = 0;
+
+    for (; i + 6 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src+3*i));
+        _mm_storeu_si128((__m128i *)(dst+i), _mm_shuffle_epi8(v, mask));
+    }
+    s24le_to_s32_c(dst+i, src+3*i, n-i);
+}
+
+// Two such loads, one per 128-bit lane, since vpshufb does not cross lanes
+__attribute__((target("avx2")))
+static void s24le_to_s32_avx2(int32_t *dst, const uint8_t *src, size_t n)
+{
+    const __m256i mask = _mm256_setr_epi8(-128, 0, 1, 2, -128, 3, 4, 5,
+                                          -128, 6, 7, 8, -128, 9, 10, 11,
+                                          -128, 0, 1, 2, -128, 3, 4, 5,
+                                          -128, 6, 7, 8, -128, 9, 10, 11);
+    size_t i = 0;
+
+    for (; i + 10 <= n; i += 8) {
+        __m256i v = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src+3*i))),
+            _mm_loadu_si128((const __m128i *)(src+3*i+12)), 1);
+        _mm256_storeu_si256((__m256i *)(dst+i), _mm256_shuffle_epi8(v, mask));
+    }
+    s24le_to_s32_c(dst+i, src+3*i, n-i);
+}
+
+__attribute__((target("ssse3")))
+static void s24be_to_s32_ssse3(int32_t *dst, const uint8_t *src, size_t n)
+{
+    const __m128i mask = _mm_setr_epi8(-128, 2, 1, 0, -128, 5, 4, 3,
+                                       -128, 8, 7, 6, -128, 11, 10, 9);
+    size_t i = 0;
+
+    for (; i + 6 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src+3*i));
+        _mm_storeu_si128((__m128i *)(dst+i), _mm_shuffle_epi8(v, mask));
+    }
+    s24be_to_s32_c(dst+i, src+3*i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void lut8_to_f32_avx2(float *dst, const uint8_t *src, size_t n, const float *lut)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src+i)));
+        _mm256_storeu_ps(dst+i, _mm256_i32gather_ps(lut, idx, 4));
+    }
+    lut8_to_f32_c(dst+i, src+i, n-i, lut);
+}
+
+__attribute__((target("sse2")))
+static void f64_to_f32_sse2(float *dst, const double *src, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(src+i));
+        __m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(src+i+2));
+        _mm_storeu_ps(dst+i, _mm_movelh_ps(lo, hi));
+    }
+    f64_to_f32_c(dst+i, src+i, n-i);
+}
+
+__attribute__((target("avx")))
+static void f64_to_f32_avx(float *dst, const double *src, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(dst+i, _mm256_cvtpd_ps(_mm256_loadu_pd(src+i)));
+    f64_to_f32_c(dst+i, src+i, n-i);
+}
+
+__attribute__((target("sse2")))
+static void s32_to_f32_sse2(float *dst, const int32_t *src, size_t n)
+{
+    const __m128 scale = _mm_set1_ps(1.0f/2147483648.0f);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(dst+i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(src+i))), scale));
+    s32_to_f32_c(dst+i, src+i, n-i);
+}
+
+__attribute__((target("avx")))
+static void s32_to_f32_avx(float *dst, const int32_t *src, size_t n)
+{
+    const __m256 scale = _mm256_set1_ps(1.0f/2147483648.0f);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst+i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(src+i))), scale));
+    s32_to_f32_c(dst+i, src+i, n-i);
+}
+
+// Sign-extended by unpacking each sample into the top half of a 32-bit lane
+__attribute__((target("sse2")))
+static void s16_to_f32_sse2(float *dst, const int16_t *src, size_t n)
+{
+    const __m128 scale = _mm_set1_ps(1.0f/32768.0f);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src+i));
+        _mm_storeu_ps(dst+i,   _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)), scale));
+        _mm_storeu_ps(dst+i+4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)), scale));
+    }
+    s16_to_f32_c(dst+i, src+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void s16_to_f32_avx2(float *dst, const int16_t *src, size_t n)
+{
+    const __m256 scale = _mm256_set1_ps(1.0f/32768.0f);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst+i, _mm256_mul_ps(_mm256_cvtepi32_ps(
+            _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src+i)))), scale));
+    s16_to_f32_c(dst+i, src+i, n-i);
+}
+
+#endif
+
+void vac_convert_init(void)
+{
+    vac_swap16       = &swap16_c;
+    vac_swap32       = &swap32_c;
+    vac_swap64       = &swap64_c;
+    vac_s8_to_s16    = &s8_to_s16_c;
+    vac_u8_to_s16    = &u8_to_s16_c;
+    vac_s24le_to_s32 = &s24le_to_s32_c;
+    vac_s24be_to_s32 = &s24be_to_s32_c;
+    vac_lut8_to_f32  = &lut8_to_f32_c;
+    vac_f64_to_f32   = &f64_to_f32_c;
+    vac_s32_to_f32   = &s32_to_f32_c;
+    vac_s16_to_f32   = &s16_to_f32_c;
+    init_g711_tables();
+
+#ifdef VAC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        vac_s8_to_s16  = &s8_to_s16_sse2;
+        vac_u8_to_s16  = &u8_to_s16_sse2;
+        vac_f64_to_f32 = &f64_to_f32_sse2;
+        vac_s32_to_f32 = &s32_to_f32_sse2;
+        vac_s16_to_f32 = &s16_to_f32_sse2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        vac_swap16       = &swap16_ssse3;
+        vac_swap32       = &swap32_ssse3;
+        vac_swap64       = &swap64_ssse3;
+        vac_s24le_to_s32 = &s24le_to_s32_ssse3;
+        vac_s24be_to_s32 = &s24be_to_s32_ssse3;
+    }
+    if (__builtin_cpu_supports("avx")) {
+        vac_f64_to_f32 = &f64_to_f32_avx;
+        vac_s32_to_f32 = &s32_to_f32_avx;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        vac_s24le_to_s32 = &s24le_to_s32_avx2;
+        vac_lut8_to_f32  = &lut8_to_f32_avx2;
+        vac_s16_to_f32   = &s16_to_f32_avx2;
+    }
+#endif
+}
@@ -0,0 +1,49 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VAC_CONVERT_H
+#define VAC_CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+* Sample converters, picked at runtime by vac_convert_init() from the best
+* instruction set the CPU supports. The widening converters may write over
+* their own source as long as src starts at or after dst and both run
+* forwards, which is how decode.c unpacks samples in place.
+*/
+
+extern void (*vac_swap16)(void *buf, size_t n);
+extern void (*vac_swap32)(void *buf, size_t n);
+extern void (*vac_swap64)(void *buf, size_t n);
+extern void (*vac_s8_to_s16)(int16_t *dst, const uint8_t *src, size_t n);
+extern void (*vac_u8_to_s16)(int16_t *dst, const uint8_t *src, size_t n);
+extern void (*vac_s24le_to_s32)(int32_t *dst, const uint8_t *src, size_t n);
+extern void (*vac_s24be_to_s32)(int32_t *dst, const uint8_t *src, size_t n);
+extern void (*vac_lut8_to_f32)(float *dst, const uint8_t *src, size_t n, const float *lut);
+extern void (*vac_f64_to_f32)(float *dst, const double *src, size_t n);
+extern void (*vac_s32_to_f32)(float *dst, const int32_t *src, size_t n);
+extern void (*vac_s16_to_f32)(float *dst, const int16_t *src, size_t n);
+
+// 256-entry expansion table for WAVE format 6 (A-law) or 7 (mu-law)
+const float *vac_g711_table(int format);
+
+void vac_convert_init(void);
+
+#endif
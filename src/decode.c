@@ -16,87 +16,253 @@
 * along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef _WIN32
+# include <fcntl.h>
+# include <io.h>
+# define popen _popen
+# define pclose _pclose
+# define dup _dup
+# define fileno _fileno
+# define fdopen _fdopen
+#else
+# include <unistd.h>
+#endif
+
 #include "unicode_support_wrapper.h"
 
+#include "aiffreader.h"
+#include "cafreader.h"
+#include "convert.h"
 #include "decode.h"
+#include "decompress.h"
+#include "downmix.h"
 #include "flac.h"
+#include "mix.h"
+#include "opusreader.h"
+#include "pool.h"
+#include "shmreader.h"
 #include "wavreader.h"
 
 #define OPUSENC_BUFFER_SAMPLES 96000
+#define OPUSENC_CHUNK_SAMPLES  9600 // Output handed to the encoder at once, ten 20 ms frames
 #define FLAC_BUFFER_EXTENSION  32768
-
-int (*vac_get_samples)(FileInfo *, void *);
-FILE *flac_input;
-fx_flac_state_t flac_state;
-uint32_t remaining_samples = 128; // Initially used for malloc and fread in vac_open_file()
-
-static inline int16_t normalize_u8(unsigned char data)
+#define BLOCK_CACHE_DEFAULT    262144 // L2 assumed when it cannot be found out
+#define BLOCK_CACHE_SHARE      2      // Of which blocks may take 1/n, the rest is filter taps, decoder and encoder
+#define BLOCK_MIN_MS           5
+
+#define FLAC_HEADER_PROBE      128 // Should be enough to parse the flac header
+#define FLAC_STREAMINFO_END    42  // fLaC, block header and STREAMINFO
+
+typedef struct FlacInput {
+    fx_flac_t *flac;
+    FILE *file;
+    int prev_read;
+    uint32_t to_read;
+    uint8_t *buf; // Bytes read ahead, kept apart from ibuf so that any buffer of its size can be decoded into
+    uint8_t header[FLAC_STREAMINFO_END]; // Replayed into the decoder after a seek
+    int64_t audio_start; // Offset of the first frame, found on the first seek
+} FlacInput;
+
+// Frames per get_samples(), two seconds unless --block says otherwise, or all of a shorter input,
+// so that a clip allocates no more than it holds
+static size_t block_frames(const FileInfo *info)
 {
-    return (data ^ 0x80) << 8;
+    const size_t max = (size_t)OPUSENC_BUFFER_SAMPLES * info->sample_rate / 48000;
+    const size_t min = info->sample_rate*BLOCK_MIN_MS/1000 ? info->sample_rate*BLOCK_MIN_MS/1000 : 1;
+    size_t ilen = max, cache;
+    uint64_t frames = info->length/info->channels;
+
+    switch (info->block.unit) {
+        case BLOCK_MS:
+            ilen = (size_t)((uint64_t)info->sample_rate*info->block.value/1000);
+            break;
+        case BLOCK_FRAMES:
+            ilen = info->block.value;
+            break;
+        case BLOCK_AUTO: // Every frame passes through ibuf, the resampler's own copy of it, and obuf
+            cache = vac_cache_size() ? vac_cache_size() : BLOCK_CACHE_DEFAULT;
+            ilen = (size_t)(cache/BLOCK_CACHE_SHARE /
+                            (info->channels*(2*sizeof(float) + sizeof(float)*48000.0/info->sample_rate)));
+            break;
+    }
+    if (ilen > max)
+        ilen = max;
+    if (ilen < min)
+        ilen = min;
+    if (info->length && !info->full_blocks && frames < ilen)
+        ilen = frames + 1; // One more, so that the first read already finds the end
+    return ilen;
 }
 
-static inline int32_t normalize_s24le(unsigned char *data)
+// Output frames per call to the resampler and the encoder, no more than one block's worth if blocks are set
+static size_t chunk_frames(const FileInfo *info)
 {
-    return (data[2] << 24) | (data[1] << 16) | (data[0] << 8);
+    size_t olen = ((uint64_t)info->ilen*48000 + info->sample_rate-1)/info->sample_rate;
+
+    return info->block.unit == BLOCK_DEFAULT || olen > OPUSENC_CHUNK_SAMPLES ? OPUSENC_CHUNK_SAMPLES : olen;
 }
 
 static int read_wav_u8(FileInfo *info, void *ibuf)
 {
-    int bytes_read = wav_read_data(info->in, (unsigned char *)ibuf+info->ilen*info->channels,
+    int bytes_read = info->read_data(info->in, (unsigned char *)ibuf+info->ilen*info->channels,
                                    info->ilen*info->channels);
-    for (int i = 0; i < info->ilen*info->channels; i++) {
-        *((int16_t *)ibuf+i) = normalize_u8(*((unsigned char *)ibuf+info->ilen*info->channels+i));
-    }
+    vac_u8_to_s16(ibuf, (unsigned char *)ibuf+info->ilen*info->channels, bytes_read);
 
     return bytes_read;
 }
 
 static int read_wav_s24le(FileInfo *info, void *ibuf)
 {
-    int bytes_read = wav_read_data(info->in, (unsigned char *)ibuf+info->ilen*info->channels,
+    int bytes_read = info->read_data(info->in, (unsigned char *)ibuf+info->ilen*info->channels,
                                    info->ilen*info->channels*3);
-    for (int i = 0, j = 0; i < info->ilen*info->channels; i++, j += 3) {
-        *((int32_t *)ibuf+i) = normalize_s24le((unsigned char *)ibuf+info->ilen*info->channels+j);
-    }
+    vac_s24le_to_s32(ibuf, (unsigned char *)ibuf+info->ilen*info->channels, bytes_read/3);
 
     return bytes_read/3;
 }
 
+// Doubles are narrowed in place, soxr then reads half as much
+static int read_wav_f64(FileInfo *info, void *ibuf)
+{
+    int samples = info->read_data(info->in, ibuf, info->ilen*info->channels*8) >> 3;
+    vac_f64_to_f32(ibuf, ibuf, samples);
+
+    return samples;
+}
+
 static int read_wav_normal(FileInfo *info, void *ibuf)
 {
-    return wav_read_data(info->in, ibuf, info->ilen*info->channels*info->bit_depth/8) >> info->shift;
+    return info->read_data(info->in, ibuf, info->ilen*info->channels*info->bit_depth/8) >> info->shift;
+}
+
+static int read_wav_g711(FileInfo *info, void *ibuf)
+{
+    const size_t offset = info->ilen*info->channels*3; // Codes go in the last quarter of ibuf
+    int bytes_read = info->read_data(info->in, (unsigned char *)ibuf+offset, info->ilen*info->channels);
+    vac_lut8_to_f32(ibuf, (unsigned char *)ibuf+offset, bytes_read, vac_g711_table(info->format));
+
+    return bytes_read;
+}
+
+static int read_pcm_s8(FileInfo *info, void *ibuf)
+{
+    int bytes_read = info->read_data(info->in, (unsigned char *)ibuf+info->ilen*info->channels,
+                                     info->ilen*info->channels);
+    vac_s8_to_s16(ibuf, (unsigned char *)ibuf+info->ilen*info->channels, bytes_read);
+
+    return bytes_read;
+}
+
+static int read_be_s24(FileInfo *info, void *ibuf)
+{
+    int bytes_read = info->read_data(info->in, (unsigned char *)ibuf+info->ilen*info->channels,
+                                     info->ilen*info->channels*3);
+    vac_s24be_to_s32(ibuf, (unsigned char *)ibuf+info->ilen*info->channels, bytes_read/3);
+
+    return bytes_read/3;
+}
+
+static int read_be_normal(FileInfo *info, void *ibuf)
+{
+    int samples = info->read_data(info->in, ibuf, info->ilen*info->channels*info->bit_depth/8) >> info->shift;
+
+    switch (info->shift) { // Swap in place, the sample width stays the same
+        case 1:
+            vac_swap16(ibuf, samples);
+            break;
+        case 2:
+            vac_swap32(ibuf, samples);
+            break;
+        case 3:
+            vac_swap64(ibuf, samples);
+            vac_f64_to_f32(ibuf, ibuf, samples);
+            break;
+    }
+
+    return samples;
+}
+
+// Shared-memory input, converted straight out of the mapped ring with nothing staged in ibuf
+static int read_shm(FileInfo *info, void *ibuf)
+{
+    const size_t width = info->bit_depth/8, want = info->ilen*info->channels;
+    const unsigned char *src;
+    size_t done = 0, n;
+
+    while (done < want && (src = shm_read_span(info->in, (want-done)*width, width, &n))) {
+        n /= width;
+        if (info->format == 6 || info->format == 7)
+            vac_lut8_to_f32((float *)ibuf+done, src, n, vac_g711_table(info->format));
+        else switch (info->bit_depth) {
+            case 8:
+                vac_u8_to_s16((int16_t *)ibuf+done, src, n);
+                break;
+            case 16:
+                memcpy((int16_t *)ibuf+done, src, n*2);
+                break;
+            case 24:
+                vac_s24le_to_s32((int32_t *)ibuf+done, src, n);
+                break;
+            case 32:
+                memcpy((int32_t *)ibuf+done, src, n*4);
+                break;
+            case 64:
+                vac_f64_to_f32((float *)ibuf+done, (const double *)src, n);
+                break;
+        }
+        shm_read_release(info->in, n*width);
+        done += n;
+    }
+
+    return done;
+}
+
+static int read_opus(FileInfo *info, void *ibuf)
+{
+    return opus_read_float(info->in, ibuf, info->ilen) * info->channels;
+}
+
+static void close_flac(void *in)
+{
+    FlacInput *fi = in;
+
+    free(fi->flac);
+    free(fi->buf);
+    if (fi->file && fi->file != stdin)
+        fclose(fi->file);
+    free(fi);
 }
 
 static int read_flac_normal(FileInfo *info, void *ibuf)
 {
-    const int offset = info->ilen*info->channels; // For ibuf, also maximum samples per iteration
-    uint8_t *const flac_buf = (uint8_t *)ibuf+offset*sizeof(int32_t); // Start of flac read buffer
+    FlacInput *fi = info->in;
+    const int offset = info->ilen*info->channels; // Maximum samples per iteration
+    uint8_t *const flac_buf = fi->buf;
+    uint32_t remaining_samples = offset;
     int samples = 0;
     int cur_read;
-    static int prev_read = FLAC_BUFFER_EXTENSION;
-    static uint32_t to_read = FLAC_BUFFER_EXTENSION;
-    remaining_samples = offset;
 
     while (1) {
-        cur_read = fread(flac_buf+prev_read-to_read, 1,
-                         FLAC_BUFFER_EXTENSION-prev_read+to_read, flac_input);
-        to_read = cur_read < FLAC_BUFFER_EXTENSION-prev_read+to_read ?
-        prev_read-to_read+cur_read : FLAC_BUFFER_EXTENSION;
-        prev_read = to_read;
-        if (!to_read)
-            break;
-
-        fx_flac_process((fx_flac_t *)info->in, flac_buf, &to_read,
+        cur_read = fread(flac_buf+fi->prev_read-fi->to_read, 1,
+                         FLAC_BUFFER_EXTENSION-fi->prev_read+fi->to_read, fi->file);
+        fi->to_read = cur_read < FLAC_BUFFER_EXTENSION-fi->prev_read+fi->to_read ?
+        fi->prev_read-fi->to_read+cur_read : FLAC_BUFFER_EXTENSION;
+        fi->prev_read = fi->to_read;
+
+        // Also with no bytes left, as a frame decoded into a full ibuf is still held by the decoder
+        fx_flac_process(fi->flac, flac_buf, &fi->to_read,
                         (int32_t *)ibuf+samples, &remaining_samples);
 
-        memmove(flac_buf, flac_buf+to_read, prev_read-to_read); // Shift unread bytes to front
+        memmove(flac_buf, flac_buf+fi->to_read, fi->prev_read-fi->to_read); // Shift unread bytes to front
 
         samples += remaining_samples;
+        if (!cur_read && !remaining_samples)
+            break;
         remaining_samples = offset - samples;
         if (!remaining_samples)
             break;
@@ -105,124 +271,665 @@ static int read_flac_normal(FileInfo *info, void *ibuf)
     return samples;
 }
 
+static int seek_pcm(FileInfo *info, uint64_t *frame)
+{
+    return wav_seek(info->in, *frame);
+}
+
+// Checks a frame header candidate at p and returns its first sample, or -1
+static int64_t flac_frame_sample(const FlacInput *fi, const uint8_t *p, size_t avail)
+{
+    const int channels = (fi->header[20] >> 1 & 7) + 1;
+    const uint32_t block_size = fi->header[10] << 8 | fi->header[11];
+    uint64_t number;
+    size_t len = 4, extra;
+    uint8_t crc = 0;
+
+    if (avail < 16 || p[0] != 0xff || (p[1] & 0xfe) != 0xf8 ||
+        !(p[2] >> 4) || (p[2] & 15) == 15 || (p[3] & 1) || (p[3] >> 1 & 7) == 3 ||
+        (p[3] >> 4 < 8 ? (p[3] >> 4) + 1 : p[3] >> 4 < 11 ? 2 : 0) != channels)
+        return -1;
+
+    // UTF-8 style coded frame or sample number
+    if (!(p[4] & 0x80)) {
+        number = p[4];
+        extra = 0;
+    } else if ((p[4] & 0xc0) == 0x80 || p[4] == 0xff) {
+        return -1;
+    } else {
+        for (extra = 1; p[4] << extra & 0x80; extra++)
+            ;
+        number = p[4] & (0x7f >> extra--);
+        for (size_t i = 1; i <= extra; i++) {
+            if ((p[4+i] & 0xc0) != 0x80)
+                return -1;
+            number = number << 6 | (p[4+i] & 0x3f);
+        }
+    }
+    len += 1 + extra;
+    len += (p[2] >> 4) == 6 ? 1 : (p[2] >> 4) == 7 ? 2 : 0;
+    len += (p[2] & 15) == 12 ? 1 : (p[2] & 15) > 12 ? 2 : 0;
+
+    for (size_t i = 0; i < len; i++) { // CRC-8, polynomial x^8 + x^2 + x + 1
+        crc ^= p[i];
+        for (int j = 0; j < 8; j++)
+            crc = crc & 0x80 ? (uint8_t)(crc << 1 ^ 0x07) : (uint8_t)(crc << 1);
+    }
+    if (crc != p[len])
+        return -1;
+
+    return p[1] & 1 ? (int64_t)number : (int64_t)(number*block_size);
+}
+
+// Walks the metadata block headers to the first frame
+static int64_t flac_audio_start(FlacInput *fi)
+{
+    uint8_t block[4];
+    int64_t pos = 4;
+
+    do {
+        if (fseek_64(fi->file, pos, SEEK_SET) || fread(block, 1, 4, fi->file) != 4)
+            return -1;
+        pos += 4 + (block[1] << 16 | block[2] << 8 | block[3]);
+    } while (!(block[0] & 0x80));
+
+    return pos;
+}
+
+// Bisects the file for the last frame starting at or before *frame, then restarts the decoder there
+static int seek_flac(FileInfo *info, uint64_t *frame)
+{
+    FlacInput *fi = info->in;
+    uint8_t buf[65536];
+    uint8_t header[FLAC_STREAMINFO_END];
+    uint32_t len = FLAC_STREAMINFO_END;
+    int64_t sample, best_sample = 0;
+    int64_t lo, hi, best;
+    size_t n;
+
+    if (memcmp(fi->header, "fLaC", 4) || ftell_64(fi->file) < 0 ||
+        fseek_64(fi->file, 0, SEEK_END) || (hi = ftell_64(fi->file)) < 0)
+        return -1;
+    if (!fi->audio_start && (fi->audio_start = flac_audio_start(fi)) < 0) {
+        fi->audio_start = 0;
+        return -1;
+    }
+    best = lo = fi->audio_start;
+
+    while (hi - lo > (int64_t)sizeof(buf)) {
+        int64_t mid = lo + (hi - lo) / 2;
+        int64_t pos = -1;
+
+        // Frame headers are at most 16 bytes, so reads overlap by that much
+        for (int64_t at = mid; pos < 0 && at < hi; at += sizeof(buf) - 16) {
+            if (fseek_64(fi->file, at, SEEK_SET))
+                return -1;
+            n = fread(buf, 1, sizeof(buf), fi->file);
+            for (size_t i = 0; i + 1 < n && at + (int64_t)i < hi; i++) {
+                if (buf[i] == 0xff && (sample = flac_frame_sample(fi, buf+i, n-i)) >= 0) {
+                    pos = at + i;
+                    break;
+                }
+            }
+            if (n < sizeof(buf))
+                break;
+        }
+
+        if (pos < 0 || (uint64_t)sample > *frame) {
+            hi = mid;
+        } else {
+            best = lo = pos;
+            best_sample = sample;
+        }
+    }
+
+    // What is left fits in one read, take the last frame that starts in time
+    if (fseek_64(fi->file, lo, SEEK_SET))
+        return -1;
+    n = fread(buf, 1, sizeof(buf), fi->file);
+    for (size_t i = 1; i + 1 < n && lo + (int64_t)i < hi; i++) {
+        if (buf[i] == 0xff && (sample = flac_frame_sample(fi, buf+i, n-i)) >= 0) {
+            if ((uint64_t)sample > *frame)
+                break;
+            best = lo + i;
+            best_sample = sample;
+        }
+    }
+    if (fseek_64(fi->file, best, SEEK_SET))
+        return -1;
+
+    // Only STREAMINFO is needed to decode frames, so mark it as the last metadata block
+    memcpy(header, fi->header, sizeof(header));
+    header[4] |= 0x80;
+    fx_flac_reset(fi->flac);
+    if (fx_flac_process(fi->flac, header, &len, NULL, NULL) != FLAC_END_OF_METADATA)
+        return -1;
+    fi->prev_read = fi->to_read = 0;
+    *frame = best_sample;
+
+    return 0;
+}
+
+// Runs the decoder command with the input quoted for the shell, and returns its stdout
+static FILE *spawn_decoder(FileInfo *info, const char *infile)
+{
+    size_t len = strlen(info->command) + 1;
+    char *cmd, *q;
+    FILE *f;
+
+    for (const char *p = info->command; *p; p++)
+        if (p[0] == '%' && p[1] == 'i')
+            len += 4*strlen(infile) + 2;
+    cmd = q = malloc(len);
+    if (!cmd)
+        return NULL;
+
+    for (const char *p = info->command; *p; p++) {
+        if (p[0] == '%' && p[1] == 'i') {
+#ifdef _WIN32
+            *q++ = '"';
+            for (const char *c = infile; *c; c++)
+                *q++ = *c;
+            *q++ = '"';
+#else
+            *q++ = '\'';
+            for (const char *c = infile; *c; c++) {
+                if (*c == '\'') {
+                    memcpy(q, "'\\''", 4);
+                    q += 4;
+                } else {
+                    *q++ = *c;
+                }
+            }
+            *q++ = '\'';
+#endif
+            p++;
+        } else if (p[0] == '%' && p[1] == '%') {
+            *q++ = *p++;
+        } else {
+            *q++ = *p;
+        }
+    }
+    *q = '\0';
+
+#ifdef _WIN32
+    info->child = popen(cmd, "rb");
+#else
+    info->child = popen(cmd, "r");
+#endif
+    free(cmd);
+    if (!info->child)
+        return NULL;
+
+    // The readers fclose() their stream, pclose() must still get the original
+    f = fdopen(dup(fileno(info->child)), "rb");
+    if (!f) {
+        pclose(info->child);
+        info->child = NULL;
+    }
+
+    return f;
+}
+
+int vac_parse_raw(const char *spec, FileInfo *info)
+{
+    static const struct {
+        const char *name;
+        int format;
+        int bit_depth;
+    } raw_formats[] = {
+        { "u8",    1, 8  },
+        { "s16le", 1, 16 },
+        { "s24le", 1, 24 },
+        { "s32le", 1, 32 },
+        { "f32le", 3, 32 },
+        { "f64le", 3, 64 },
+        { "alaw",  6, 8  },
+        { "ulaw",  7, 8  }
+    };
+    char name[8];
+
+    if (sscanf(spec, "%d:%d:%7s", &info->sample_rate, &info->channels, name) != 3 ||
+        info->sample_rate <= 0 || info->channels <= 0 || info->channels > 255) {
+        fprintf(stderr, "Raw input must be described as rate:channels:format.\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(raw_formats)/sizeof(*raw_formats); i++) {
+        if (!strcmp(name, raw_formats[i].name)) {
+            info->format    = raw_formats[i].format;
+            info->bit_depth = raw_formats[i].bit_depth;
+            info->raw       = 1;
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "Unknown raw sample format: %s\n", name);
+    return 1;
+}
+
+int vac_parse_block(const char *spec, BlockSize *block)
+{
+    char *end;
+    unsigned long n;
+
+    if (!strcmp(spec, "auto")) {
+        block->unit = BLOCK_AUTO;
+        return 0;
+    }
+    n = strtoul(spec, &end, 10);
+    if (end == spec || !n || (*end && (strcmp(end, "ms") || n > 2000)) || n > UINT_MAX) {
+        fprintf(stderr, "Block size must be auto, a length from 1ms to 2000ms, or a number of frames.\n");
+        return 1;
+    }
+    block->unit  = *end ? BLOCK_MS : BLOCK_FRAMES;
+    block->value = (unsigned)n;
+
+    return 0;
+}
+
 int vac_open_file(const char *infile, FileInfo *info, void **ibuf, void **obuf)
 {
-    info->in = wav_read_open(infile);
-    if (!info->in) {
-        fprintf(stderr, "Unable to open input file.\n");
+    FILE *f = NULL;
+    int64_t pos;
+    int c;
+
+    if (info->downmix) // Around everything else, stems included
+        return vac_downmix_open(info->downmix, infile, info, ibuf, obuf);
+    if (info->stems)
+        return vac_mix_open(info->stems, info, ibuf, obuf);
+
+    *ibuf = NULL;
+    info->close = NULL;
+    info->seek  = NULL;
+
+    if (info->shm) { // Format comes from the ring header, read as it is produced
+        info->in = shm_read_open(infile);
+        if (!info->in || !shm_get_header(info->in, &info->format, &info->channels,
+                                         &info->sample_rate, &info->bit_depth)) {
+            fprintf(stderr, "Unable to attach to shared-memory ring.\n");
+            if (info->in)
+                shm_read_close(info->in);
+            return 1;
+        }
+        info->close     = &shm_read_close;
+        info->length    = 0;
+
+        goto pcm;
+    }
+
+    info->child = NULL;
+    if (info->stream) {
+        f = info->stream;
+    } else if (info->command) {
+        f = spawn_decoder(info, infile);
+    } else if (!strcmp(infile, "-")) {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        f = stdin;
+    } else {
+        f = fopen_utf8(infile, "rb");
+    }
+    if (!f) {
+        fprintf(stderr, info->command ? "Unable to run decoder command.\n" : "Unable to open input file.\n");
         return 1;
     }
 
+    if (info->raw) { // No header to probe, the format was given on the command line
+        info->in = wav_read_open_raw(f, info->format, info->channels,
+                                     info->sample_rate, info->bit_depth);
+        info->length = 0;
+        if (!info->in) {
+            fprintf(stderr, "Unable to allocate sufficient memory.\n");
+            goto fail;
+        }
+        info->read_data = &wav_read_data;
+        info->close     = &wav_read_close;
+        info->seek      = &seek_pcm;
+
+        goto pcm;
+    }
+
+probe:
+
+    // Peek at the first byte without seeking, so pipes work as well
+    pos = ftell_64(f);
+    c = fgetc(f);
+    if (pos < 0)
+        ungetc(c, f);
+    else
+        fseek_64(f, pos, SEEK_SET);
+
+    if (c == VAC_GZIP_MAGIC || c == VAC_ZSTD_MAGIC) { // Decoded from a pipe fed by another thread
+        FILE *d = vac_decompress_open(f, c);
+        if (!d) {
+            fprintf(stderr, "Unable to decompress input file.\n");
+            goto fail;
+        }
+        f = d;
+        goto probe;
+    }
+
+    if (c == 'F' || c == 'c') { // AIFF/AIFF-C or CAF
+        const int aiff = c == 'F';
+
+        info->in = aiff ? aiff_read_open(f) : caf_read_open(f);
+        if (!info->in) {
+            fprintf(stderr, "Unable to allocate sufficient memory.\n");
+            goto fail;
+        }
+        info->read_data = aiff ? &aiff_read_data : &caf_read_data;
+        info->close     = aiff ? &aiff_read_close : &caf_read_close;
+
+        if (!(aiff ? &aiff_get_header : &caf_get_header)(info->in, &info->format, &info->channels,
+                                                          &info->sample_rate, &info->bit_depth,
+                                                          &info->big_endian, &info->length)) {
+            fprintf(stderr, "Invalid or compressed %s file.\n", aiff ? "AIFF" : "CAF");
+            goto fail;
+        }
+
+        goto header;
+    }
+
+    if (c == 'O') { // Ogg Opus, already 48 kHz so nothing is left to resample
+        info->in = opus_read_open(f);
+        if (!info->in) {
+            fprintf(stderr, "Unable to allocate sufficient memory.\n");
+            goto fail;
+        }
+        info->close = &opus_read_close;
+
+        if (!opus_get_header(info->in, &info->channels, &info->length)) {
+            fprintf(stderr, "Invalid or unsupported Ogg file, only Opus can be read.\n");
+            goto fail;
+        }
+        info->length     *= info->channels;
+        info->sample_rate = 48000;
+        info->format      = 3;
+        info->bit_depth   = 32;
+        info->vorbis_order = 1;
+        info->get_samples = &read_opus;
+
+        info->ilen = block_frames(info);
+        info->olen = chunk_frames(info);
+
+        info->ibuf_size = info->ilen*info->channels*sizeof(float);
+        *ibuf = malloc(info->ibuf_size);
+        if (!*ibuf) {
+            fprintf(stderr, "Unable to allocate sufficient memory.\n");
+            goto fail;
+        }
+
+        goto end;
+    }
+
+    if (c != 'R' && c != 'B' && c != 'r') { // Not RIFF, RF64, BW64 or Wave64, try flac
+        goto flac;
+    }
+
+    info->in = wav_read_open(f);
+    if (!info->in) {
+        fprintf(stderr, "Unable to allocate sufficient memory.\n");
+        goto fail;
+    }
+    info->read_data = &wav_read_data;
+    info->close     = &wav_read_close;
+    info->seek      = &seek_pcm;
+
     if (!wav_get_header(info->in, &info->format, &info->channels,
                         &info->sample_rate, &info->bit_depth, &info->length)) {
-        wav_read_close(info->in);
-
-        goto flac; // Not wav, try flac
+        fprintf(stderr, "Invalid input file.\n");
+        goto fail;
     }
 
-    if (!info->format || !info->channels || !info->sample_rate || !info->bit_depth || !info->length) {
-        fprintf(stderr, "Bad WAVE file.\n");
-        return 1;
+header:
+
+    if (!info->format || !info->channels || !info->sample_rate || !info->bit_depth) {
+        fprintf(stderr, "Bad input file.\n");
+        goto fail;
+    }
+    info->length /= info->bit_depth/8; // Zero if streamed with unknown length
+
+pcm:
+
+    if (info->format == 6 || info->format == 7) { // A-law and mu-law, expanded straight to float
+        if (info->bit_depth != 8) {
+            fprintf(stderr, "Bad G.711 file.\n");
+            goto fail;
+        }
+        info->get_samples = info->shm ? &read_shm : &read_wav_g711;
+        info->ilen = block_frames(info);
+        info->olen = chunk_frames(info);
+
+        info->ibuf_size = info->ilen*info->channels*sizeof(float);
+        *ibuf = malloc(info->ibuf_size);
+        if (!*ibuf) {
+            fprintf(stderr, "Unable to allocate sufficient memory.\n");
+            goto fail;
+        }
+
+        goto end;
     }
-    info->length /= info->bit_depth/8;
 
-    if (info->format != 1 && info->format != 3) { // To-do: alaw and ulaw
-        fprintf(stderr, "Only LPCM and floating-point samples are supported.\n");
-        return 1;
+    if (info->format != 1 && info->format != 3) {
+        fprintf(stderr, "Only LPCM, floating-point and G.711 samples are supported.\n");
+        goto fail;
+    }
+    if (info->format == 3 && info->bit_depth != 32 && info->bit_depth != 64) {
+        fprintf(stderr, "Only 32- and 64-bit floating-point samples are supported.\n");
+        goto fail;
     }
 
     switch (info->bit_depth) { // The function we will be looping
         case 8:
-            vac_get_samples = &read_wav_u8;
+            info->get_samples = info->big_endian ? &read_pcm_s8 : &read_wav_u8;
             break;
         case 16:
-            vac_get_samples = &read_wav_normal;
+            info->get_samples = info->big_endian ? &read_be_normal : &read_wav_normal;
             info->shift     = 1;
             break;
         case 24:
-            vac_get_samples = &read_wav_s24le;
+            info->get_samples = info->big_endian ? &read_be_s24 : &read_wav_s24le;
             break;
         case 32:
-            vac_get_samples = &read_wav_normal;
+            info->get_samples = info->big_endian ? &read_be_normal : &read_wav_normal;
             info->shift     = 2;
             break;
         case 64:
-            vac_get_samples = &read_wav_normal;
+            info->get_samples = info->big_endian ? &read_be_normal : &read_wav_f64;
             info->shift     = 3;
             break;
         default:
             fprintf(stderr, "Something went wrong.\n");
-            return 1;
+            goto fail;
     }
+    if (info->shm)
+        info->get_samples = &read_shm;
 
-    info->ilen = OPUSENC_BUFFER_SAMPLES * info->sample_rate / 48000;
-    info->olen = OPUSENC_BUFFER_SAMPLES;
+    info->ilen = block_frames(info);
+    info->olen = chunk_frames(info);
 
     // For 8-bit and 24-bit sources, we need to convert to the next 2^n-bit
-    vac_get_samples != &read_wav_normal ?
-    (*ibuf = malloc(info->ilen*info->channels*(1+info->bit_depth/8))) :
-    (*ibuf = malloc(info->ilen*info->channels*info->bit_depth/8));
+    info->ibuf_size = info->bit_depth == 8 || info->bit_depth == 24 ?
+                      info->ilen*info->channels*(1+info->bit_depth/8) :
+                      info->ilen*info->channels*info->bit_depth/8;
+    *ibuf = malloc(info->ibuf_size);
     if (!*ibuf) {
         fprintf(stderr, "Unable to allocate sufficient memory.\n");
-        return 1;
+        goto fail;
     }
 
     goto end;
 
 flac:
 
-    info->in = FX_FLAC_ALLOC_DEFAULT();
-    *ibuf = malloc(remaining_samples); // Should be enough to parse the flac header
-    if (!info->in || !*ibuf) {
-        fprintf(stderr, "Unable to allocate sufficient memory.\n");
-        return 1;
+    {
+        FlacInput *fi = calloc(1, sizeof(*fi));
+        uint32_t len;
+
+        info->in = fi;
+        if (!fi) {
+            fprintf(stderr, "Unable to allocate sufficient memory.\n");
+            goto fail;
+        }
+        fi->file    = f;
+        info->close = &close_flac;
+
+        fi->flac = FX_FLAC_ALLOC_DEFAULT();
+        fi->buf  = malloc(FLAC_BUFFER_EXTENSION);
+        *ibuf = malloc(FLAC_HEADER_PROBE);
+        if (!fi->flac || !fi->buf || !*ibuf) {
+            fprintf(stderr, "Unable to allocate sufficient memory.\n");
+            goto fail;
+        }
+
+        fi->prev_read = fread(*ibuf, 1, FLAC_HEADER_PROBE, f);
+        len = fi->prev_read;
+        if (!fx_flac_process(fi->flac, *ibuf, &len, NULL, NULL)) { // Not flac either, fail
+            fprintf(stderr, "Invalid input file.\n");
+            goto fail;
+        }
+        fi->to_read = len; // Bytes past the header are kept for read_flac_normal()
+        if (fi->prev_read >= FLAC_STREAMINFO_END)
+            memcpy(fi->header, *ibuf, FLAC_STREAMINFO_END);
+
+        info->sample_rate = fx_flac_get_streaminfo(fi->flac, FLAC_KEY_SAMPLE_RATE);
+        info->channels    = fx_flac_get_streaminfo(fi->flac, FLAC_KEY_N_CHANNELS);
+        info->bit_depth   = fx_flac_get_streaminfo(fi->flac, FLAC_KEY_SAMPLE_SIZE);
+        info->length      = fx_flac_get_streaminfo(fi->flac, FLAC_KEY_N_SAMPLES) * info->channels;
+        info->format      = 0; // Signal flac input, length is zero if unknown
+
+        if (!info->channels || !info->sample_rate || !info->bit_depth) {
+            fprintf(stderr, "Bad FLAC file.\n");
+            goto fail;
+        }
+
+        info->get_samples = &read_flac_normal;
+        info->seek        = &seek_flac;
+
+        info->ilen = block_frames(info);
+        info->olen = chunk_frames(info);
+
+        memcpy(fi->buf, (uint8_t *)*ibuf+fi->to_read, fi->prev_read-fi->to_read); // Continue decoding without seeking back
+        info->ibuf_size = info->ilen*info->channels*sizeof(int32_t);
+        *ibuf = realloc(*ibuf, info->ibuf_size);
+        if (!*ibuf) {
+            fprintf(stderr, "Unable to allocate sufficient memory.\n");
+            goto fail;
+        }
+        fi->prev_read -= fi->to_read;
+        fi->to_read = 0;
     }
 
-    flac_input = fopen_utf8(infile, "rb");
-    remaining_samples = fread(*ibuf, 1, remaining_samples, flac_input);
-    flac_state = fx_flac_process((fx_flac_t *)info->in, *ibuf, &remaining_samples, NULL, NULL);
-    if (!flac_state) { // Not flac either, fail
-        fprintf(stderr, "Invalid input file.\n");
-        return 1;
+end:
+
+    info->passthrough = info->sample_rate == 48000; // Nothing to resample, e.g. Opus input
+    *obuf = malloc(info->olen*info->channels*sizeof(float)); // For ope_encoder_write_float()
+    if (!*obuf) {
+        fprintf(stderr, "Unable to allocate sufficient memory.\n");
+        goto fail;
     }
 
-    info->sample_rate = fx_flac_get_streaminfo((fx_flac_t *)info->in, FLAC_KEY_SAMPLE_RATE);
-    info->channels    = fx_flac_get_streaminfo((fx_flac_t *)info->in, FLAC_KEY_N_CHANNELS);
-    info->bit_depth   = fx_flac_get_streaminfo((fx_flac_t *)info->in, FLAC_KEY_SAMPLE_SIZE);
-    info->length      = fx_flac_get_streaminfo((fx_flac_t *)info->in, FLAC_KEY_N_SAMPLES) * info->channels;
-    info->format      = 0; // Signal flac input
+    return 0;
 
-    if (!info->channels || !info->sample_rate || !info->bit_depth || !info->length) {
-        fprintf(stderr, "Bad FLAC file.\n");
-        return 1;
-    }
+fail:
 
-    fseek(flac_input, 0, SEEK_SET); // Reset file pointer for decoding
-    fx_flac_reset(info->in);
+    if (info->close)
+        info->close(info->in);
+    else if (f && f != stdin)
+        fclose(f);
+    free(*ibuf);
+    *ibuf = NULL;
+    if (info->child)
+        pclose(info->child);
 
-    vac_get_samples = &read_flac_normal;
+    return 1;
+}
 
-    info->ilen = OPUSENC_BUFFER_SAMPLES * info->sample_rate / 48000;
-    info->olen = OPUSENC_BUFFER_SAMPLES;
+int vac_probe_file(const char *infile, FileInfo *info, const char **container)
+{
+    FILE *f = fopen_utf8(infile, "rb");
+    void *in;
+    int c, ok = 0;
 
-    *ibuf = realloc(*ibuf, info->ilen*info->channels*sizeof(int32_t)+FLAC_BUFFER_EXTENSION);
-    if (!*ibuf) {
-        fprintf(stderr, "Unable to allocate sufficient memory.\n");
+    if (f)
+        f = vac_decompress_probe(f);
+    if (!f)
         return 1;
+    c = fgetc(f);
+    ungetc(c, f);
+
+    if (c == 'F' || c == 'c') {
+        const int aiff = c == 'F';
+        *container = aiff ? "aiff" : "caf";
+        in = aiff ? aiff_read_open(f) : caf_read_open(f);
+        if (!in)
+            goto done;
+        ok = (aiff ? &aiff_get_header : &caf_get_header)(in, &info->format, &info->channels,
+                                                          &info->sample_rate, &info->bit_depth,
+                                                          &info->big_endian, &info->length);
+        (aiff ? &aiff_read_close : &caf_read_close)(in);
+        f = NULL;
+    } else if (c == 'O') { // OpusHead and the last page's granule position, no decoder
+        *container = "ogg";
+        ok = opus_probe(f, &info->channels, &info->length);
+        f = NULL;
+        info->length     *= info->channels;
+        info->sample_rate = 48000;
+        info->format      = 3;
+        info->bit_depth   = 32;
+        return !ok;
+    } else if (c == 'R' || c == 'B' || c == 'r') {
+        *container = "wave";
+        in = wav_read_open(f);
+        if (!in)
+            goto done;
+        ok = wav_get_header(in, &info->format, &info->channels,
+                            &info->sample_rate, &info->bit_depth, &info->length);
+        wav_read_close(in);
+        f = NULL;
+    } else { // STREAMINFO is all that is needed, and it always comes first
+        uint8_t h[FLAC_STREAMINFO_END];
+        *container = "flac";
+        if (fread(h, 1, sizeof(h), f) != sizeof(h) || memcmp(h, "fLaC", 4) || (h[4] & 0x7f))
+            goto done;
+        info->sample_rate = h[18] << 12 | h[19] << 4 | h[20] >> 4;
+        info->channels    = (h[20] >> 1 & 7) + 1;
+        info->bit_depth   = ((h[20] & 1) << 4 | h[21] >> 4) + 1;
+        info->length      = ((uint64_t)(h[21] & 15) << 32 | (uint32_t)h[22] << 24 |
+                             h[23] << 16 | h[24] << 8 | h[25]) * info->channels;
+        info->format      = 0;
+        ok = info->sample_rate > 0;
+        goto done;
     }
+    if (ok && info->bit_depth >= 8)
+        info->length /= info->bit_depth/8;
+    ok = ok && info->channels && info->bit_depth;
 
-end:
+done:
 
-    *obuf = malloc(info->olen*info->channels*sizeof(float)); // For ope_encoder_write_float()
-    if (!*obuf) {
-        fprintf(stderr, "Unable to allocate sufficient memory.\n");
-        return 1;
-    }
+    if (f && f != stdin)
+        fclose(f);
 
-    return 0;
+    return !ok;
 }
 
-void vac_close_file(void *in, int format)
+int vac_close_file(FileInfo *info)
 {
-    format ? wav_read_close(in) : free(in);
+    char buf[4096];
+
+    info->close(info->in);
+    if (!info->child)
+        return 0;
+
+    // Let the decoder finish whatever the reader left unread, so its exit status means something
+    while (fread(buf, 1, sizeof(buf), info->child) == sizeof(buf))
+        ;
+    if (pclose(info->child)) {
+        fprintf(stderr, "Decoder command failed.\n");
+        return 1;
+    }
+
+    return 0;
 }
\ No newline at end of file
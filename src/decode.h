@@ -19,22 +19,55 @@
 #ifndef VAC_DECODE_H
 #define VAC_DECODE_H
 
+#include <stdint.h>
+#include <stdio.h>
+
+enum { BLOCK_DEFAULT, BLOCK_MS, BLOCK_FRAMES, BLOCK_AUTO };
+
+typedef struct BlockSize { // How much is decoded, resampled and encoded at a time, see vac_parse_block()
+    int unit;       // Two seconds by default
+    unsigned value; // Milliseconds, or frames at the input rate
+} BlockSize;
+
 typedef struct FileInfo {
     void *in;
     int format;
     int channels;
     int sample_rate;
     int bit_depth;
-    unsigned int length; // Total samples
+    uint64_t length; // Total samples
     int shift;
+    int big_endian; // AIFF/CAF byte order, 8-bit samples are then signed
     size_t ilen;
     size_t olen;
+    size_t ibuf_size; // Bytes, any buffer of this size can stand in for ibuf
+    int raw; // Headerless input described by vac_parse_raw()
+    int shm; // Input names a shared-memory ring, see shmreader.h
+    FILE *stream; // Already open input, e.g. a tar member, infile is then only a label
+    int passthrough; // Already 48 kHz, soxr is skipped and ibuf goes to the encoder as is
+    int full_blocks; // Whole blocks even for shorter input, as stems are read in step
+    BlockSize block;
+    const char *command; // External decoder writing to stdout, %i is replaced by the input
+    FILE *child; // Its pipe, closed by vac_close_file() to collect the exit status
+    const struct Stems *stems; // Several inputs mixed into one, infile is then unused, see mix.h
+    const struct Downmix *downmix; // Channels picked or folded down before the resampler, see downmix.h
+    int vorbis_order; // Surround channels as Opus orders them (L C R), not as WAVE does (L R C)
+    int (*read_data)(void *, unsigned char *, unsigned int); // Byte source for PCM input
+    int (*get_samples)(struct FileInfo *, void *); // Fills ibuf, returns fewer samples at the end
+    int (*seek)(struct FileInfo *, uint64_t *frame); // To *frame or the last frame before it, NULL if unseekable
+    void (*close)(void *);
 } FileInfo;
 
-extern int (*vac_get_samples)(FileInfo *, void *);
+int vac_parse_raw(const char *spec, FileInfo *info);
+
+// --block, auto to fit the cache, a length such as 50ms, or a number of frames
+int vac_parse_block(const char *spec, BlockSize *block);
 
 int vac_open_file(const char *infile, FileInfo *info, void **ibuf, void **obuf);
 
-void vac_close_file(void *in, int format);
+int vac_close_file(FileInfo *info);
+
+// Reads only the header of a file, no decoder or buffers are set up
+int vac_probe_file(const char *infile, FileInfo *info, const char **container);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,259 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE // F_SETPIPE_SZ
+
+#include <errno.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+# include <fcntl.h>
+# include <io.h>
+# define pipe(fds) _pipe(fds, PIPE_SIZE, _O_BINARY)
+# define close _close
+# define write _write
+# define fdopen _fdopen
+#else
+# include <fcntl.h>
+# include <signal.h>
+# include <unistd.h>
+#endif
+
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+# include <zstd.h>
+#endif
+
+#include "decompress.h"
+
+#define PIPE_SIZE  (1 << 20) // Lets the thread run ahead of the decoder
+#define CHUNK_SIZE (1 << 16)
+
+struct decompressor {
+    FILE *in;
+    int fd; // Write end of the pipe
+    int magic;
+    int gone; // The decoder closed its end early
+};
+
+FILE *vac_pipe_open(int *fd)
+{
+    int fds[2];
+    FILE *out;
+
+    if (pipe(fds))
+        return NULL;
+#ifdef F_SETPIPE_SZ
+    fcntl(fds[1], F_SETPIPE_SZ, PIPE_SIZE);
+#endif
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN); // Closing the input early must not kill us
+#endif
+    out = fdopen(fds[0], "rb");
+    if (!out) {
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+    *fd = fds[1];
+
+    return out;
+}
+
+int vac_pipe_write(int fd, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+
+    while (len) {
+        int n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) // The reader went away
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+void vac_pipe_close(int fd)
+{
+    close(fd);
+}
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+static int write_all(struct decompressor *d, const unsigned char *buf, size_t len)
+{
+    if (vac_pipe_write(d->fd, buf, len)) {
+        d->gone = 1;
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+#ifdef HAVE_ZLIB
+static int inflate_gzip(struct decompressor *d, unsigned char *in, unsigned char *out)
+{
+    z_stream zs = {0};
+    int ret = Z_OK;
+
+    if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK)
+        return -1;
+
+    while (ret != Z_STREAM_END || zs.avail_in || !feof(d->in)) {
+        if (!zs.avail_in) {
+            zs.avail_in = fread(in, 1, CHUNK_SIZE, d->in);
+            zs.next_in  = in;
+            if (!zs.avail_in)
+                break;
+        }
+        if (ret == Z_STREAM_END) // Concatenated members, as written by gzip -c a b
+            inflateReset(&zs);
+        zs.avail_out = CHUNK_SIZE;
+        zs.next_out  = out;
+        ret = inflate(&zs, Z_NO_FLUSH);
+        if ((ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) ||
+            write_all(d, out, CHUNK_SIZE - zs.avail_out))
+            break;
+    }
+    inflateEnd(&zs);
+
+    return ret == Z_STREAM_END ? 0 : -1;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static int decompress_zstd(struct decompressor *d, unsigned char *in, unsigned char *out)
+{
+    ZSTD_DStream *ds = ZSTD_createDStream();
+    size_t ret = 1, len;
+
+    if (!ds)
+        return -1;
+
+    while ((len = fread(in, 1, CHUNK_SIZE, d->in))) {
+        ZSTD_inBuffer ib = { in, len, 0 };
+        while (ib.pos < ib.size) {
+            ZSTD_outBuffer ob = { out, CHUNK_SIZE, 0 };
+            ret = ZSTD_decompressStream(ds, &ob, &ib);
+            if (ZSTD_isError(ret) || write_all(d, out, ob.pos))
+                goto done;
+        }
+    }
+done:
+    ZSTD_freeDStream(ds);
+
+    return ret ? -1 : 0; // Zero once a frame is complete
+}
+#endif
+
+static void *decompress_thread(void *arg)
+{
+    struct decompressor *d = arg;
+    unsigned char *in = malloc(CHUNK_SIZE), *out = malloc(CHUNK_SIZE);
+    int ret = -1;
+
+    if (in && out) {
+#ifdef HAVE_ZLIB
+        if (d->magic == VAC_GZIP_MAGIC)
+            ret = inflate_gzip(d, in, out);
+#endif
+#ifdef HAVE_ZSTD
+        if (d->magic == VAC_ZSTD_MAGIC)
+            ret = decompress_zstd(d, in, out);
+#endif
+    }
+    // The decoder stopping early just means it had all it wanted
+    if (ret && !d->gone)
+        fprintf(stderr, "Compressed input is corrupt or truncated.\n");
+
+    close(d->fd);
+    if (d->in != stdin)
+        fclose(d->in);
+    free(in);
+    free(out);
+    free(d);
+
+    return NULL;
+}
+
+FILE *vac_decompress_open(FILE *in, int magic)
+{
+    struct decompressor *d;
+    pthread_t thread;
+    FILE *out;
+
+#ifndef HAVE_ZLIB
+    if (magic == VAC_GZIP_MAGIC) {
+        fprintf(stderr, "This build cannot read gzip-compressed input.\n");
+        return NULL;
+    }
+#endif
+#ifndef HAVE_ZSTD
+    if (magic == VAC_ZSTD_MAGIC) {
+        fprintf(stderr, "This build cannot read zstd-compressed input.\n");
+        return NULL;
+    }
+#endif
+
+    d = malloc(sizeof(*d));
+    if (!d)
+        return NULL;
+    out = vac_pipe_open(&d->fd);
+    if (!out) {
+        free(d);
+        return NULL;
+    }
+    d->in    = in;
+    d->magic = magic;
+    d->gone  = 0;
+
+    if (pthread_create(&thread, NULL, &decompress_thread, d)) {
+        fclose(out);
+        close(d->fd);
+        free(d);
+        return NULL;
+    }
+    pthread_detach(thread);
+
+    return out;
+}
+
+FILE *vac_decompress_probe(FILE *in)
+{
+    long pos = ftell(in);
+    int c = fgetc(in);
+    FILE *out;
+
+    if (pos < 0)
+        ungetc(c, in);
+    else
+        fseek(in, pos, SEEK_SET);
+    if (c != VAC_GZIP_MAGIC && c != VAC_ZSTD_MAGIC)
+        return in;
+
+    out = vac_decompress_open(in, c);
+    if (!out && in != stdin)
+        fclose(in);
+
+    return out;
+}
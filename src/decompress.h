@@ -0,0 +1,46 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VAC_DECOMPRESS_H
+#define VAC_DECOMPRESS_H
+
+#include <stdio.h>
+
+// Pipe fed by a helper thread, returns the read end and stores the write end in fd
+FILE *vac_pipe_open(int *fd);
+// Fails once the reader has closed its end, SIGPIPE is ignored
+int vac_pipe_write(int fd, const void *buf, size_t len);
+void vac_pipe_close(int fd);
+
+// First byte of a gzip or zstd stream, as peeked by vac_open_file()
+#define VAC_GZIP_MAGIC 0x1f
+#define VAC_ZSTD_MAGIC 0x28
+
+/*
+* Hands the compressed stream to a detached thread and returns the read end
+* of a pipe carrying the decompressed bytes, so decoding overlaps with
+* decompression. The thread owns in from here on and closes it when done,
+* or as soon as the returned stream is closed. Returns NULL if support for
+* this format was not compiled in or the thread could not be started.
+*/
+FILE *vac_decompress_open(FILE *in, int magic);
+
+// Peeks at the first byte, returns in itself if it is not compressed, or NULL after closing it on failure
+FILE *vac_decompress_probe(FILE *in);
+
+#endif
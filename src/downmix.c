@@ -0,0 +1,358 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "convert.h"
+#include "downmix.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define VAC_X86 1
+# include <immintrin.h>
+#endif
+
+#define MINUS_3DB 0.70710678f
+
+typedef struct Row { // One output channel, input channels with a zero gain are left out
+    int taps;
+    int channel[255];
+    float gain[255];
+} Row;
+
+typedef struct Downmixer {
+    FileInfo info; // The input itself
+    void *ibuf;    // Its samples as decoded
+    float *pcm;    // The same as float, for 8- and 16-bit input
+    Row *row;
+    int channels;
+} Downmixer;
+
+// Roles of the channels in each layout: Left, Right, Centre, LFE, left and right surround, back centre
+static const char *const wave_layouts[9] = {
+    NULL, "C", "LR", "LRC", "LRlr", "LRClr", "LRCFlr", "LRCFblr", "LRCFlrlr"
+};
+static const char *const vorbis_layouts[9] = {
+    NULL, "C", "LR", "LCR", "LRlr", "LCRlr", "LCRlrF", "LCRlrbF", "LCRlrlrF"
+};
+
+static void (*matrix)(float *dst, const float *src, size_t frames, const Row *row, int in, int out);
+
+static void matrix_c(float *dst, const float *src, size_t frames, const Row *row, int in, int out)
+{
+    for (size_t f = 0; f < frames; f++, src += in) {
+        for (int o = 0; o < out; o++) {
+            float sum = 0;
+            for (int t = 0; t < row[o].taps; t++)
+                sum += row[o].gain[t]*src[row[o].channel[t]];
+            *dst++ = sum;
+        }
+    }
+}
+
+#ifdef VAC_X86
+
+// Four frames at a time, one channel of each gathered into a vector
+__attribute__((target("sse2")))
+static void matrix_sse2(float *dst, const float *src, size_t frames, const Row *row, int in, int out)
+{
+    size_t f = 0;
+
+    for (; f + 4 <= frames; f += 4) {
+        const float *p = src + f*in;
+        float lanes[4];
+
+        for (int o = 0; o < out; o++) {
+            __m128 acc = _mm_setzero_ps();
+            for (int t = 0; t < row[o].taps; t++) {
+                const float *q = p + row[o].channel[t];
+                acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(row[o].gain[t]),
+                                                 _mm_setr_ps(q[0], q[in], q[2*in], q[3*in])));
+            }
+            if (out == 1) {
+                _mm_storeu_ps(dst + f, acc);
+                continue;
+            }
+            _mm_storeu_ps(lanes, acc);
+            for (int k = 0; k < 4; k++)
+                dst[(f+k)*out+o] = lanes[k];
+        }
+    }
+    matrix_c(dst + f*out, src + f*in, frames-f, row, in, out);
+}
+
+// Eight frames at a time, and stereo is interleaved in registers
+__attribute__((target("avx2")))
+static void matrix_avx2(float *dst, const float *src, size_t frames, const Row *row, int in, int out)
+{
+    const __m256i stride = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(in));
+    size_t f = 0;
+
+    for (; f + 8 <= frames; f += 8) {
+        const float *p = src + f*in;
+        __m256 acc[2];
+        float lanes[8];
+
+        for (int o = 0; o < out; o++) {
+            __m256 sum = _mm256_setzero_ps();
+            for (int t = 0; t < row[o].taps; t++)
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(row[o].gain[t]),
+                                                       _mm256_i32gather_ps(p + row[o].channel[t], stride, 4)));
+            if (out <= 2) {
+                acc[o] = sum;
+                continue;
+            }
+            _mm256_storeu_ps(lanes, sum);
+            for (int k = 0; k < 8; k++)
+                dst[(f+k)*out+o] = lanes[k];
+        }
+        if (out == 1) {
+            _mm256_storeu_ps(dst + f, acc[0]);
+        } else if (out == 2) {
+            __m256 lo = _mm256_unpacklo_ps(acc[0], acc[1]), hi = _mm256_unpackhi_ps(acc[0], acc[1]);
+            _mm256_storeu_ps(dst + 2*f,   _mm256_permute2f128_ps(lo, hi, 0x20));
+            _mm256_storeu_ps(dst + 2*f+8, _mm256_permute2f128_ps(lo, hi, 0x31));
+        }
+    }
+    matrix_c(dst + f*out, src + f*in, frames-f, row, in, out);
+}
+
+#endif
+
+void vac_downmix_init(void)
+{
+    matrix = &matrix_c;
+#ifdef VAC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        matrix = &matrix_sse2;
+    if (__builtin_cpu_supports("avx2"))
+        matrix = &matrix_avx2;
+#endif
+}
+
+int vac_parse_downmix(const char *spec, Downmix *d)
+{
+    if (!strcmp(spec, "mono")) {
+        d->channels = d->fold = 1;
+    } else if (!strcmp(spec, "stereo")) {
+        d->channels = d->fold = 2;
+    } else {
+        fprintf(stderr, "Unknown downmix: %s. Use mono or stereo.\n", spec);
+        return 1;
+    }
+
+    return 0;
+}
+
+int vac_parse_channels(const char *spec, Downmix *d)
+{
+    char *end;
+
+    d->channels = d->fold = 0;
+    do {
+        long c = strtol(spec, &end, 10);
+        if (end == spec || c < 1 || c > 255 || (*end && *end != ',') || d->channels == 255) {
+            fprintf(stderr, "Invalid channel list: %s. Use input channels from 1, e.g. 1,2\n", spec);
+            return 1;
+        }
+        d->pick[d->channels++] = (unsigned char)(c-1);
+        spec = end+1;
+    } while (*end);
+
+    return 0;
+}
+
+// Standard gains into stereo or mono, scaled so that no output can exceed full scale
+static void fold_rows(const char *layout, int fold, Row *row)
+{
+    const float g = MINUS_3DB;
+    float gains[2][8], sum[2] = {0}, scale;
+    const int in = (int)strlen(layout);
+
+    for (int c = 0; c < in; c++) {
+        float l = 0, r = 0;
+        switch (layout[c]) {
+            case 'L': l = 1; break;
+            case 'R': r = 1; break;
+            case 'C': l = r = g; break;
+            case 'l': l = g; break;
+            case 'r': r = g; break;
+            case 'b': l = r = 0.5f; break;
+            default: break; // LFE
+        }
+        gains[0][c] = l;
+        gains[1][c] = r;
+        sum[0] += l;
+        sum[1] += r;
+    }
+    scale = 1.0f/(sum[0] > sum[1] ? sum[0] : sum[1]);
+
+    for (int o = 0; o < fold; o++) {
+        for (int c = 0; c < in; c++) {
+            float gain = fold == 2 ? gains[o][c]*scale : (gains[0][c]+gains[1][c])*scale/2;
+            if (gain == 0)
+                continue;
+            row[o].channel[row[o].taps] = c;
+            row[o].gain[row[o].taps++]  = gain;
+        }
+    }
+}
+
+static int read_downmix(FileInfo *info, void *ibuf)
+{
+    Downmixer *d = info->in;
+    const FileInfo *in = &d->info;
+    const float *src = d->ibuf;
+    int samples = d->info.get_samples(&d->info, d->ibuf);
+
+    if (samples <= 0)
+        return samples;
+    if (d->pcm) {
+        vac_s16_to_f32(d->pcm, d->ibuf, samples);
+        src = d->pcm;
+    } else if (in->format != 3 && in->format != 6 && in->format != 7) { // Left-justified in 32 bits, converted in place
+        vac_s32_to_f32(d->ibuf, d->ibuf, samples);
+    }
+    matrix(ibuf, src, samples/in->channels, d->row, in->channels, d->channels);
+
+    return samples/in->channels*d->channels;
+}
+
+static int seek_downmix(FileInfo *info, uint64_t *frame)
+{
+    Downmixer *d = info->in;
+
+    return d->info.seek(&d->info, frame);
+}
+
+static void close_downmix(void *in)
+{
+    Downmixer *d = in;
+
+    if (d->info.close)
+        d->info.close(d->info.in);
+    free(d->ibuf);
+    free(d->pcm);
+    free(d->row);
+    free(d);
+}
+
+int vac_downmix_open(const Downmix *dm, const char *infile, FileInfo *info, void **ibuf, void **obuf)
+{
+    Downmixer *d = calloc(1, sizeof(*d));
+    const char *layout;
+    void *inner_obuf;
+    int identity;
+
+    *ibuf = *obuf = NULL;
+    if (!d || !(d->row = calloc(dm->channels, sizeof(*d->row)))) {
+        fprintf(stderr, "Unable to allocate sufficient memory.\n");
+        free(d);
+        return 1;
+    }
+    d->channels = dm->channels;
+    d->info = *info;
+    d->info.downmix = NULL;
+    if (vac_open_file(infile, &d->info, &d->ibuf, &inner_obuf)) {
+        free(d->row);
+        free(d);
+        return 1;
+    }
+    free(inner_obuf);
+
+    if (d->info.format == 1 && d->info.bit_depth == 64) {
+        fprintf(stderr, "64-bit LPCM is unsupported. Use float instead.\n");
+        goto fail;
+    }
+    if (dm->fold) {
+        layout = d->info.channels <= 8 ?
+                 (d->info.vorbis_order ? vorbis_layouts : wave_layouts)[d->info.channels] : NULL;
+        if (!layout) {
+            fprintf(stderr, "No standard downmix from %d channels, pick them with --channels.\n", d->info.channels);
+            goto fail;
+        }
+        fold_rows(layout, dm->fold, d->row);
+    } else {
+        for (int o = 0; o < dm->channels; o++) {
+            if (dm->pick[o] >= d->info.channels) {
+                fprintf(stderr, "Channel %d picked, but the input has only %d.\n", dm->pick[o]+1, d->info.channels);
+                goto fail;
+            }
+            d->row[o].taps       = 1;
+            d->row[o].channel[0] = dm->pick[o];
+            d->row[o].gain[0]    = 1;
+        }
+    }
+
+    identity = d->channels == d->info.channels;
+    for (int o = 0; o < d->channels && identity; o++)
+        identity = d->row[o].taps == 1 && d->row[o].channel[0] == o && d->row[o].gain[0] == 1;
+    if (identity) { // Read the input as it is, without converting it to float
+        if (!(*obuf = malloc(d->info.olen*d->info.channels*sizeof(float)))) {
+            fprintf(stderr, "Unable to allocate sufficient memory.\n");
+            goto fail;
+        }
+        *ibuf = d->ibuf;
+        *info = d->info;
+        free(d->row);
+        free(d);
+        return 0;
+    }
+
+    if (d->info.format && d->info.format != 3 && d->info.format != 6 && d->info.format != 7 &&
+        d->info.bit_depth <= 16 && !(d->pcm = malloc(d->info.ilen*d->info.channels*sizeof(float)))) {
+        fprintf(stderr, "Unable to allocate sufficient memory.\n");
+        goto fail;
+    }
+    *ibuf = malloc(d->info.ilen*d->channels*sizeof(float));
+    *obuf = malloc(d->info.olen*d->channels*sizeof(float));
+    if (!*ibuf || !*obuf) {
+        fprintf(stderr, "Unable to allocate sufficient memory.\n");
+        goto fail;
+    }
+
+    info->in          = d;
+    info->close       = &close_downmix;
+    info->get_samples = &read_downmix;
+    info->seek        = d->info.seek ? &seek_downmix : NULL;
+    info->child       = d->info.child; // Collected by vac_close_file() on this info instead
+    d->info.child     = NULL;
+    info->sample_rate = d->info.sample_rate;
+    info->format      = d->info.format == 6 || d->info.format == 7 ? d->info.format : 3; // Float either way
+    info->bit_depth   = d->info.bit_depth; // For the encoder's LSB depth
+    info->channels    = d->channels;
+    info->passthrough = d->info.passthrough;
+    info->length      = d->info.length/d->info.channels*d->channels;
+    info->ilen        = d->info.ilen;
+    info->olen        = d->info.olen;
+    info->ibuf_size   = info->ilen*info->channels*sizeof(float);
+
+    return 0;
+
+fail:
+
+    free(*ibuf);
+    free(*obuf);
+    *ibuf = *obuf = NULL;
+    vac_close_file(&d->info);
+    d->info.close = NULL;
+    close_downmix(d);
+    return 1;
+}
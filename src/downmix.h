@@ -0,0 +1,50 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VAC_DOWNMIX_H
+#define VAC_DOWNMIX_H
+
+#include "decode.h"
+
+typedef struct Downmix { // The channels encoded, made from the input's before the resampler
+    int channels; // Output channels
+    int fold;     // Standard matrix down to that many, otherwise pick[] selects input channels
+    unsigned char pick[255]; // Input channel of each output channel, from 0
+} Downmix;
+
+// --downmix mono or stereo
+int vac_parse_downmix(const char *spec, Downmix *d);
+
+// --channels, a comma-separated list of input channels counted from 1
+int vac_parse_channels(const char *spec, Downmix *d);
+
+/*
+* Opens the input with its own decoder, and fills info so that it reads like
+* a floating-point input with the downmixed channels, so that the resampler and
+* the encoder only ever see those. Folding follows ITU-R BS.775, with centre and
+* surrounds at -3 dB and the LFE dropped, scaled so that full-scale input cannot
+* clip. Surround input is taken in WAVE order (L R C LFE Ls Rs), or in Vorbis
+* order (L C R Ls Rs LFE) for Opus input. A downmix that changes nothing leaves
+* the input as it is.
+*/
+int vac_downmix_open(const Downmix *d, const char *infile, FileInfo *info, void **ibuf, void **obuf);
+
+// Picks the matrix code for the CPU, call once before opening any input
+void vac_downmix_init(void);
+
+#endif
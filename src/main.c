@@ -16,75 +16,263 @@
 * along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 
-#if defined(_MSC_VER)
-# include <getopt.h>
+#ifdef _WIN32
+# include <direct.h>
+# include <fcntl.h>
+# include <io.h>
+# define mkdir(path, mode) _mkdir(path)
 #else
-# include <unistd.h>
+# include <sys/stat.h>
 #endif
 
+#include <getopt.h>
+
 #include "unicode_support_wrapper.h"
 
 #include <opusenc.h>
 #include <soxr.h>
 
+#include "convert.h"
 #include "decode.h"
+#include "decompress.h"
+#include "downmix.h"
+#include "mix.h"
+#include "pool.h"
+#include "preview.h"
+#include "resample.h"
+#include "ring.h"
+#include "tar.h"
 #include "version.h"
 
+#define PIPELINE_DEPTH 4 // Blocks per pair of stages, how far one may run ahead of the next
+
 typedef struct SoxBlock {
     soxr_t resampler;
     soxr_error_t soxerr;
     soxr_io_spec_t io;
+    Resampler *fixed; // Built-in, stands in for soxr on the ratios it covers
 } SoxBlock;
 
 typedef struct OpusBlock {
     OggOpusEnc *enc;
     OggOpusComments *comments;
     int opusencerr;
+    const OpusEncCallbacks *callbacks; // Written through these instead of outfile if set
+    void *user_data;
 } OpusBlock;
 
-int init_resampler(FileInfo info, SoxBlock *sb)
-{
-    soxr_quality_spec_t quality = { // Resampler quality settings
-        .precision      = 33,
-        .phase_response = 50,
-        .passband_end   = 0.913,
-        .stopband_begin = 1,
-        .e              = NULL,
-        .flags          = SOXR_ROLLOFF_NONE | SOXR_HI_PREC_CLOCK
-    };
+typedef struct Timings { // Wall-clock seconds per step of an encode, summed over files, for --startup-stats
+    double open;      // Header, decoder and buffers, and seeking to a preview
+    double encoder;   // ope_encoder_create_*() and its settings
+    double resampler; // Filter design
+    double encode;    // Decoding, resampling and encoding
+    double drain;     // Flushing the encoder and closing everything
+    unsigned files;
+} Timings;
+
+typedef struct Settings {
+    opus_int32 bitrate;
+    opus_int32 lsb;
+    int have_bitrate;
+    int have_lsb;
+    int vbr_mode;
+    int have_preview;
+    Preview preview;
+    int recipe; // Index into recipes[], 0 picks one from the bitrate
+    int threads; // For soxr, the cores this encode may use
+    Timings *timings; // Added to if set
+    int quiet; // No banner or progress, for batches running in parallel
+} Settings;
+
+typedef struct Batch { // Inputs encoded into one output directory
+    char **inputs;
+    size_t count;
+    const char *outdir;
+    FileInfo info;
+    Settings s;
+    Timings *timings; // One per input, summed once all are done
+} Batch;
+
+typedef struct Block { // Passed from one pipeline stage to the next, and back once used
+    void *data;
+    size_t len;           // Samples as decoded, or frames as resampled
+    uint64_t tot_samples; // Decoded so far, for the progress the encoder stage shows
+    uint64_t blocks;
+} Block;
+
+typedef struct Source { // Hands decoded blocks to soxr, or straight to the encoder, in pieces of any size
+    FileInfo *info;
+    unsigned char *ibuf;
+    size_t sample_size; // Bytes per sample in ibuf
+    size_t pos;         // Frames of the current block already handed out
+    size_t frames;      // Frames in the current block
+    uint64_t tot_samples;
+    uint64_t blocks;
+    int eof;
+    Ring *decoded;      // Blocks come from the decoder thread if set
+    Ring *decoded_free; // And go back through this one
+    Block *block;       // The current one
+} Source;
+
+typedef struct Pipeline { // Decoder and resampler on threads of their own, ahead of the encoder
+    Ring decoded, decoded_free;
+    Ring resampled, resampled_free;
+    Block block[2*PIPELINE_DEPTH]; // Decoded, then resampled ones
+    FileInfo *info;
+    Source *src;
+    SoxBlock *sb;
+    pthread_t decoder, resampler;
+    int decoding, resampling; // Threads started
+    int stop;     // Set by the encoder stage, the others then wind down
+    int finished; // The encoder stage has seen the last resampled block
+} Pipeline;
+
+typedef struct Probe { // One line of --probe output per input
+    char **inputs;
+    char **lines;
+} Probe;
+
+typedef struct MemoryOutput { // One encoded tar member
+    unsigned char *data;
+    size_t len;
+    size_t size;
+} MemoryOutput;
 
+// The layout get_samples() leaves in ibuf, in soxr's terms
+static int input_type(FileInfo info, soxr_datatype_t *type)
+{
+    // Float whatever the source's depth: 64-bit is narrowed, G.711 expanded, and mixes and downmixes are summed
+    if (info.format == 3 || info.format == 6 || info.format == 7) {
+        *type = SOXR_FLOAT32_I;
+        return 0;
+    }
     switch (info.bit_depth) {
         case 8:
         case 16:
-            sb->io = soxr_io_spec(SOXR_INT16_I, SOXR_FLOAT32_I);
+            *type = SOXR_INT16_I;
             break;
         case 24:
         case 32:
-            sb->io = (info.format == 1) ? soxr_io_spec(SOXR_INT32_I, SOXR_FLOAT32_I) :
-                                          soxr_io_spec(SOXR_FLOAT32_I, SOXR_FLOAT32_I);
+            *type = SOXR_INT32_I;
             break;
         case 64:
-            if (info.format == 1) {
-                fprintf(stderr, "64-bit LPCM is unsupported. Use float instead.\n");
-                return 1;
-            } else {
-                sb->io = soxr_io_spec(SOXR_FLOAT64_I, SOXR_FLOAT32_I);
-            }
-            break;
+            fprintf(stderr, "64-bit LPCM is unsupported. Use float instead.\n");
+            return 1;
         default:
             fprintf(stderr, "Unsupported word length: %d\n", info.bit_depth);
             return 1;
     }
     if (!info.format) // FLAC override
-        sb->io = soxr_io_spec(SOXR_INT32_I, SOXR_FLOAT32_I);
+        *type = SOXR_INT32_I;
+
+    return 0;
+}
+
+static const struct Recipe { // Resampler presets for --resampler
+    const char *name;
+    double precision;    // Bits
+    double passband_end; // Fraction of the lower Nyquist frequency
+    unsigned long flags;
+} recipes[] = {
+    { "auto",     0,  0,     0 }, // One of the below, from the bitrate
+    { "fast",     16, 0.85,  SOXR_ROLLOFF_NONE },
+    { "balanced", 20, 0.9,   SOXR_ROLLOFF_NONE },
+    { "archival", 33, 0.913, SOXR_ROLLOFF_NONE | SOXR_HI_PREC_CLOCK }
+};
+
+static int parse_recipe(const char *name)
+{
+    for (size_t i = 0; i < sizeof(recipes)/sizeof(recipes[0]); i++)
+        if (!strcmp(name, recipes[i].name))
+            return (int)i;
+
+    fprintf(stderr, "Resampler presets: auto, fast, balanced, archival\n");
+    return -1;
+}
+
+// Highest frequency the encoder keeps at this bitrate, in Hz
+static int coded_bandwidth(const OpusBlock *ob, opus_int32 bitrate, int channels)
+{
+    opus_int32 bandwidth = OPUS_AUTO;
+    opus_int32 per_stream = bitrate/((channels+1)/2); // Roughly, channels are coupled in pairs
+
+    ope_encoder_ctl(ob->enc, OPUS_GET_BANDWIDTH(&bandwidth));
+    if (bandwidth == OPUS_AUTO || bandwidth == OPUS_BANDWIDTH_FULLBAND) // Only settled once audio is coded,
+        bandwidth = per_stream < 11000 ? OPUS_BANDWIDTH_WIDEBAND :     // so follow libopus' music thresholds
+                    per_stream < 12000 ? OPUS_BANDWIDTH_SUPERWIDEBAND : OPUS_BANDWIDTH_FULLBAND;
+
+    switch (bandwidth) {
+        case OPUS_BANDWIDTH_NARROWBAND:
+            return 4000;
+        case OPUS_BANDWIDTH_MEDIUMBAND:
+            return 6000;
+        case OPUS_BANDWIDTH_WIDEBAND:
+            return 8000;
+        case OPUS_BANDWIDTH_SUPERWIDEBAND:
+            return 12000;
+        default:
+            return 20000;
+    }
+}
+
+/*
+* The auto recipe spends precision only where the encoder can keep it: below
+* 24 kbps per channel the coding noise is far above 16 bits, and below 64 kbps
+* above 20 bits. Its passband also ends where a narrower encoder bandwidth does,
+* which widens the transition band and shortens the filter.
+*/
+static const struct Recipe *pick_recipe(int recipe, FileInfo info, const OpusBlock *ob,
+                                        opus_int32 bitrate, double *passband_end)
+{
+    const struct Recipe *r = &recipes[recipe];
+    double nyquist = (info.sample_rate < 48000 ? info.sample_rate : 48000)/2.0;
+    int cutoff;
+
+    if (info.format == 6 || info.format == 7) // G.711 is band-limited to 3.4 kHz
+        r = &recipes[1];
+    *passband_end = r->passband_end;
+    if (r != &recipes[0])
+        return r;
+
+    r = bitrate/info.channels < 24000 ? &recipes[1] :
+        bitrate/info.channels < 64000 ? &recipes[2] : &recipes[3];
+    *passband_end = r->passband_end;
+    cutoff = coded_bandwidth(ob, bitrate, info.channels);
+    if (cutoff < 20000 && cutoff/nyquist < r->passband_end) // Fullband keeps the recipe's own
+        *passband_end = cutoff/nyquist;
+
+    return r;
+}
+
+int init_resampler(FileInfo info, SoxBlock *sb, const struct Recipe *r, double passband_end, int threads)
+{
+    soxr_quality_spec_t quality = { // Resampler quality settings
+        .precision      = r->precision,
+        .phase_response = 50,
+        .passband_end   = passband_end,
+        .stopband_begin = 1,
+        .e              = NULL,
+        .flags          = r->flags
+    };
+    soxr_runtime_spec_t runtime = soxr_runtime_spec(threads < info.channels ? threads : info.channels); // Split by channel
+    soxr_datatype_t itype;
+
+    if (input_type(info, &itype))
+        return 1;
+    sb->io = soxr_io_spec(itype, SOXR_FLOAT32_I);
+    sb->fixed = vac_resample_create(info.sample_rate, info.channels, itype, quality.precision, quality.passband_end);
+    if (sb->fixed)
+        return 0;
 
     sb->resampler = soxr_create(info.sample_rate, 48000, info.channels,
-                                &sb->soxerr, &sb->io, &quality, NULL);
+                                &sb->soxerr, &sb->io, &quality, &runtime);
     if (!sb->resampler) {
         fprintf(stderr, "Error initializing soxr: %s\n", sb->soxerr);
         return 1;
@@ -93,6 +281,42 @@ int init_resampler(FileInfo info, SoxBlock *sb)
     return 0;
 }
 
+static int write_stdout(void *user_data, const unsigned char *ptr, opus_int32 len)
+{
+    return fwrite(ptr, 1, len, (FILE *)user_data) != (size_t)len;
+}
+
+static int close_stdout(void *user_data)
+{
+    return fflush((FILE *)user_data);
+}
+
+static int write_memory(void *user_data, const unsigned char *ptr, opus_int32 len)
+{
+    MemoryOutput *mo = user_data;
+
+    if (mo->len + len > mo->size) {
+        size_t size = mo->size ? mo->size : 1 << 20;
+        unsigned char *data;
+        while (size < mo->len + len)
+            size *= 2;
+        data = realloc(mo->data, size);
+        if (!data)
+            return 1;
+        mo->data = data;
+        mo->size = size;
+    }
+    memcpy(mo->data+mo->len, ptr, len);
+    mo->len += len;
+
+    return 0;
+}
+
+static int close_memory(void *user_data)
+{
+    return 0;
+}
+
 int init_encoder(const char *outfile, FileInfo info, OpusBlock *ob, opus_int32 *bitrate,
                         int have_bitrate, opus_int32 *lsb, int have_lsb, int vbr_mode, int *mapping)
 {
@@ -101,8 +325,20 @@ int init_encoder(const char *outfile, FileInfo info, OpusBlock *ob, opus_int32 *
 
     ob->comments = ope_comments_create();
     ope_comments_add(ob->comments, "encoder", "vac-enc");
-    ob->enc = ope_encoder_create_file(outfile, ob->comments, 48000,
-                                      info.channels, *mapping, &ob->opusencerr);
+    if (ob->callbacks) {
+        ob->enc = ope_encoder_create_callbacks(ob->callbacks, ob->user_data, ob->comments, 48000,
+                                               info.channels, *mapping, &ob->opusencerr);
+    } else if (!strcmp(outfile, "-")) {
+        static const OpusEncCallbacks stdout_callbacks = { write_stdout, close_stdout };
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        ob->enc = ope_encoder_create_callbacks(&stdout_callbacks, stdout, ob->comments, 48000,
+                                               info.channels, *mapping, &ob->opusencerr);
+    } else {
+        ob->enc = ope_encoder_create_file(outfile, ob->comments, 48000,
+                                          info.channels, *mapping, &ob->opusencerr);
+    }
     if (!ob->enc) {
         fprintf(stderr, "Cannot write to output file: %s\n", ope_strerror(ob->opusencerr));
         return 1;
@@ -124,6 +360,7 @@ int init_encoder(const char *outfile, FileInfo info, OpusBlock *ob, opus_int32 *
     ope_encoder_ctl(ob->enc, OPE_SET_COMMENT_PADDING(0));
     ope_encoder_ctl(ob->enc, OPE_SET_MUXING_DELAY(0));
     if (!have_lsb) *lsb = info.bit_depth > 24 ? 24 : info.bit_depth;
+    if (!have_lsb && (info.format == 6 || info.format == 7)) *lsb = 14; // G.711 expands to 13-14 bits
     if (*lsb > 24 || *lsb < 8) {
         fprintf(stderr, "LSB out of range 8-24.\n");
         return 1;
@@ -137,91 +374,288 @@ void usage(const char *path)
 {
     fprintf(stderr, "vac-enc %s (using %s, %s, libsoxr %s)\n",
             VAC_VERSION, opus_get_version_string(), ope_get_version_string(), SOXR_THIS_VERSION_STR);
-    fprintf(stderr, "Usage: %s [-b kbps] <WAVE/FLAC input> <Ogg Opus output>\n", path);
+    fprintf(stderr, "Usage: %s [-b kbps] [--raw rate:channels:format] [--shm | --decoder command] <WAVE/FLAC/AIFF/CAF/Opus input> <Ogg Opus output>\n", path);
+    fprintf(stderr, "       %s [-b kbps] --from-tar <tar input> <output directory or .tar>\n", path);
+    fprintf(stderr, "       %s [-b kbps] [-j jobs] [--list file] <input>... <output directory>\n", path);
+    fprintf(stderr, "       %s --probe <input>...\n", path);
+    fprintf(stderr, "       %s [-b kbps] [--assign] [--gain dB] --stem <input> [[--gain dB] --stem <input>]... <Ogg Opus output>\n", path);
+    fprintf(stderr, "Use - as input or output to read from stdin or write to stdout.\n");
+    fprintf(stderr, "With --shm, the input is the name of a shared-memory ring buffer.\n");
+    fprintf(stderr, "With --decoder command, the input is decoded by running command, in which %%i stands for\n"
+                    "the input, e.g. --decoder \"ffmpeg -v error -i %%i -f wav -\". Its output is read like a file.\n");
+    fprintf(stderr, "With --preview offset:duration or loudest:duration, only that many seconds are encoded,\n"
+                    "starting at offset or where the input is loudest. WAVE and FLAC files only.\n");
+    fprintf(stderr, "Stems are summed, mono ones into every channel, or with --assign laid out one after another\n"
+                    "as the output channels. --gain applies to the next stem.\n");
+    fprintf(stderr, "With --downmix mono or stereo, surround and stereo input is folded down with the standard\n"
+                    "matrices, and with --channels list, e.g. --channels 3 or 1,2, only those input channels are kept.\n");
+    fprintf(stderr, "With --block auto, 50ms or 2048, that much is decoded, resampled and encoded at a time, by default\n"
+                    "two seconds. auto sizes blocks to stay in the L2 cache.\n");
+    fprintf(stderr, "Raw input formats: u8, s16le, s24le, s32le, f32le, f64le, alaw, ulaw\n");
+    fprintf(stderr, "Resampler presets (--resampler): fast, balanced, archival, or auto to pick one from the bitrate\n");
+    fprintf(stderr, "With --startup-stats, the time spent setting up each encode is printed at the end.\n");
 }
 
-int main(int argc, char **argv)
+// soxr_input_fn_t, decodes the next block once the current one is used up
+static size_t pull_input(void *state, soxr_in_t *data, size_t requested)
 {
-    int ret;
-    int ch;
-    opus_int32 bitrate;
-    opus_int32 lsb;
-    int have_bitrate = 0;
-    int have_lsb = 0;
-    int vbr_mode = 2;
-    int mapping = 0;
-    FileInfo info;
-    SoxBlock sb;
-    OpusBlock ob;
-    size_t idone, odone;
-    void *ibuf, *obuf;
-    clock_t start, end;
-#ifdef WIN_UNICODE
-    int argc_utf8;
-    char **argv_utf8;
+    Source *src = state;
+    FileInfo *info = src->info;
+    size_t n;
 
-    (void)argc;
-    (void)argv;
-    init_commandline_arguments_utf8(&argc_utf8, &argv_utf8);
-#endif
+    if (src->pos == src->frames) {
+        int samples;
 
-    while ((ch = getopt(argc_utf8, argv_utf8, "b:l:v:")) != -1) {
-        switch (ch) {
-            case 'b':
-                bitrate = (opus_int32)(atof(optarg)*1000);
-                have_bitrate = 1;
-                break;
-            case 'l':
-                lsb = atoi(optarg);
-                have_lsb = 1;
-                break;
-            case 'v':
-                vbr_mode = atoi(optarg);
-                break;
-            case '?':
-            default:
-                usage(argv_utf8[0]);
-                return 1;
+        if (src->eof)
+            return 0; // End of input, soxr flushes what it still holds
+        if (src->decoded) { // Decoded on its own thread, the block before is done with
+            if (src->block)
+                vac_ring_push(src->decoded_free, src->block);
+            src->block = vac_ring_pop(src->decoded);
+            src->ibuf  = src->block->data;
+            samples    = (int)src->block->len;
+        } else {
+            samples = info->get_samples(info, src->ibuf);
         }
+        if (samples < 0)
+            samples = 0;
+        src->eof    = samples < info->ilen*info->channels;
+        src->frames = samples/info->channels;
+        src->pos    = 0;
+        src->tot_samples += samples;
+        src->blocks++;
+        if (!src->frames)
+            return 0;
     }
-    if (argc_utf8 - optind < 2) {
-        usage(argv_utf8[0]);
-        return 1;
+
+    n = src->frames-src->pos < requested ? src->frames-src->pos : requested;
+    *data = src->ibuf + src->pos*info->channels*src->sample_size;
+    src->pos += n;
+
+    return n;
+}
+
+static size_t resample(SoxBlock *sb, float *out, size_t olen)
+{
+    return sb->fixed ? vac_resample_output(sb->fixed, out, olen) : soxr_output(sb->resampler, out, olen);
+}
+
+// Takes decoded blocks until the decoder's last, once the encoder needs no more
+static void drain_input(Source *src)
+{
+    while (!src->eof) {
+        if (src->block)
+            vac_ring_push(src->decoded_free, src->block);
+        src->block = vac_ring_pop(src->decoded);
+        src->eof   = src->block->len < src->info->ilen*src->info->channels;
     }
-    if (!strcmp(argv_utf8[argc_utf8-1], "-") || !strcmp(argv_utf8[argc_utf8-2], "-")) {
-        fprintf(stderr, "stdin/stdout is not supported.\n");
-        return 1;
+}
+
+// Decoder stage, until a block comes back short
+static void *decode_stage(void *arg)
+{
+    Pipeline *p = arg;
+    size_t len;
+
+    do {
+        Block *b = vac_ring_pop(&p->decoded_free);
+        int samples = __atomic_load_n(&p->stop, __ATOMIC_ACQUIRE) ? 0 : p->info->get_samples(p->info, b->data);
+
+        b->len = len = samples > 0 ? samples : 0;
+        vac_ring_push(&p->decoded, b);
+    } while (len == p->info->ilen*p->info->channels);
+
+    return NULL;
+}
+
+// Resampler stage, pulls from the decoder stage through pull_input() until soxr has flushed
+static void *resample_stage(void *arg)
+{
+    Pipeline *p = arg;
+    size_t len;
+
+    do {
+        Block *b = vac_ring_pop(&p->resampled_free);
+
+        len = __atomic_load_n(&p->stop, __ATOMIC_ACQUIRE) ? 0 : resample(p->sb, b->data, p->info->olen);
+        b->len         = len;
+        b->tot_samples = p->src->tot_samples;
+        b->blocks      = p->src->blocks;
+        vac_ring_push(&p->resampled, b);
+    } while (len);
+    drain_input(p->src);
+
+    return NULL;
+}
+
+// Encoder stage, the next resampled block, handing back the one before
+static Block *next_resampled(Pipeline *p, Block *prev)
+{
+    Block *b;
+
+    if (prev)
+        vac_ring_push(&p->resampled_free, prev);
+    b = vac_ring_pop(&p->resampled);
+    p->finished = !b->len;
+
+    return b;
+}
+
+static void stop_pipeline(Pipeline *p)
+{
+    __atomic_store_n(&p->stop, 1, __ATOMIC_RELEASE);
+    if (p->resampling) {
+        Block *b = NULL;
+        while (!p->finished)
+            b = next_resampled(p, b);
+        pthread_join(p->resampler, NULL);
+    } else if (p->decoding) {
+        drain_input(p->src);
     }
-    if (!strcmp(argv_utf8[argc_utf8-1], argv_utf8[argc_utf8-2])) {
-        fprintf(stderr, "Input and output file cannot be the same.\n");
-        return 1;
+    if (p->decoding)
+        pthread_join(p->decoder, NULL);
+
+    for (int i = 1; i < 2*PIPELINE_DEPTH; i++) // The first of each kind are ibuf and obuf
+        if (i != PIPELINE_DEPTH)
+            free(p->block[i].data);
+    vac_ring_free(&p->decoded);
+    vac_ring_free(&p->decoded_free);
+    vac_ring_free(&p->resampled);
+    vac_ring_free(&p->resampled_free);
+    p->decoding = p->resampling = 0;
+}
+
+/*
+* Moves decoding, and resampling unless the input is passed through, to threads
+* of their own, connected by rings of PIPELINE_DEPTH blocks each way. Blocks are
+* the same size as ibuf and obuf, which are the first of them, and every stage
+* runs through the same calls in the same order as on one thread, so the output
+* is the same. Nonzero if nothing could be started, everything then stays on
+* this thread.
+*/
+static int start_pipeline(Pipeline *p, FileInfo *info, Source *src, SoxBlock *sb, void *ibuf, void *obuf)
+{
+    const size_t osize = info->olen*info->channels*sizeof(float);
+
+    p->info = info;
+    p->src  = src;
+    p->sb   = sb;
+    if (vac_ring_init(&p->decoded, PIPELINE_DEPTH) || vac_ring_init(&p->decoded_free, PIPELINE_DEPTH) ||
+        vac_ring_init(&p->resampled, PIPELINE_DEPTH) || vac_ring_init(&p->resampled_free, PIPELINE_DEPTH))
+        goto fail;
+    for (int i = 0; i < PIPELINE_DEPTH; i++) {
+        Block *d = &p->block[i], *r = &p->block[PIPELINE_DEPTH+i];
+        d->data = i ? malloc(info->ibuf_size) : ibuf;
+        r->data = i ? malloc(osize) : obuf;
+        if (!d->data || !r->data)
+            goto fail;
+        vac_ring_push(&p->decoded_free, d);
+        vac_ring_push(&p->resampled_free, r);
     }
 
-    ret = vac_open_file(argv_utf8[argc_utf8-2], &info, &ibuf, &obuf);
-    if (ret)
-        return 1;
+    src->decoded      = &p->decoded;
+    src->decoded_free = &p->decoded_free;
+    if (pthread_create(&p->decoder, NULL, &decode_stage, p)) {
+        src->decoded = src->decoded_free = NULL;
+        goto fail;
+    }
+    p->decoding = 1;
+    // Should this fail, this thread resamples, still fed by the decoder thread
+    p->resampling = !info->passthrough && !pthread_create(&p->resampler, NULL, &resample_stage, p);
 
-    ret = init_resampler(info, &sb);
-    if (ret)
-        return 1;
+    return 0;
+
+fail:
+
+    stop_pipeline(p);
+    return 1;
+}
+
+// Drops the pre-roll and stops at the end of the preview window, returns the frames to write
+static size_t clip_window(PreviewWindow *w, void **buf, size_t frames, size_t frame_size)
+{
+    size_t drop = w->drop < frames ? w->drop : frames;
+
+    w->drop -= drop;
+    frames  -= drop;
+    *buf     = (unsigned char *)*buf + drop*frame_size;
+    if (frames > w->left)
+        frames = w->left;
+    w->left -= frames;
+
+    return frames;
+}
+
+static int encode_file(const char *infile, const char *outfile, FileInfo info, OpusBlock ob, Settings s)
+{
+    int ret = 1;
+    int mapping = 0;
+    SoxBlock sb = {0};
+    PreviewWindow w = { .left = UINT64_MAX }; // Everything unless a preview is cut
+    Source src = { .info = &info };
+    Pipeline pl = {0};
+    Block *b = NULL;
+    uint64_t shown = 0, tot_samples, blocks;
+    size_t odone;
+    soxr_datatype_t itype;
+    void *ibuf, *obuf, *out;
+    const struct Recipe *recipe = NULL;
+    double passband_end;
+    double t[6] = {0};
+    double start, end; // Wall clock, as CPU time would add up the threads
 
-    ret = init_encoder(argv_utf8[argc_utf8-1], info, &ob, &bitrate,
-                       have_bitrate, &lsb, have_lsb, vbr_mode, &mapping);
-    if (ret)
+    t[0] = vac_now();
+    if (vac_open_file(infile, &info, &ibuf, &obuf))
         return 1;
+    if (input_type(info, &itype))
+        goto cleanup;
+    src.ibuf = ibuf;
+    src.sample_size = itype == SOXR_INT16_I ? sizeof(int16_t) : sizeof(float);
 
-    fprintf(stderr, "\n\tEncoding library  ::  %s\n", opus_get_version_string());
-    fprintf(stderr, "\n\tTarget bitrate    ::  %.3f kbps (%s)\n", (float)bitrate/1000,
-            vbr_mode < 2 ? (vbr_mode < 1 ? "CBR" : "CVBR") : "VBR");
-    fprintf(stderr, "\n\tSample rate       ::  ");
-    if (info.sample_rate != 48000) fprintf(stderr, "%.1f kHz -> ", (float)info.sample_rate/1000);
-    fprintf(stderr, "48.0 kHz\n\n");
+    if (s.have_preview && vac_preview_seek(&info, ibuf, s.preview, &w))
+        goto cleanup;
 
-    start = clock();
+    t[1] = vac_now();
+    if (init_encoder(outfile, info, &ob, &s.bitrate, s.have_bitrate,
+                     &s.lsb, s.have_lsb, s.vbr_mode, &mapping))
+        goto cleanup;
+    t[2] = vac_now();
 
-    while (1) { // Main encoding loop, maximum two seconds of 48 kHz audio per iteration
-        int samples;
-        static int tot_samples = 0;
+    if (!info.passthrough) { // After the encoder, whose bitrate the recipe may depend on
+        recipe = pick_recipe(s.recipe, info, &ob, s.bitrate, &passband_end);
+        if (init_resampler(info, &sb, recipe, passband_end, s.threads))
+            goto cleanup;
+        if (!sb.fixed) {
+            soxr_set_input_fn(sb.resampler, &pull_input, &src, info.ilen);
+        } else if (vac_resample_set_input_fn(sb.fixed, &pull_input, &src, info.ilen)) {
+            fprintf(stderr, "Unable to allocate sufficient memory.\n");
+            goto cleanup;
+        }
+    }
+    t[3] = vac_now();
+    if (s.threads > 1) // Cores to spare for decoding and resampling alongside the encoder
+        start_pipeline(&pl, &info, &src, &sb, ibuf, obuf);
+
+    if (!s.quiet) {
+        fprintf(stderr, "\n\tEncoding library  ::  %s\n", opus_get_version_string());
+        fprintf(stderr, "\n\tTarget bitrate    ::  %.3f kbps (%s)\n", (float)s.bitrate/1000,
+                s.vbr_mode < 2 ? (s.vbr_mode < 1 ? "CBR" : "CVBR") : "VBR");
+        fprintf(stderr, "\n\tSample rate       ::  ");
+        if (info.sample_rate != 48000) fprintf(stderr, "%.1f kHz -> ", (float)info.sample_rate/1000);
+        fprintf(stderr, "48.0 kHz");
+        if (recipe) fprintf(stderr, " (%s %s, %.1f kHz passband)", recipe->name, sb.fixed ? "polyphase" : "soxr",
+                            passband_end*(info.sample_rate < 48000 ? info.sample_rate : 48000)/2000);
+        fprintf(stderr, "\n\n");
+        if (info.block.unit != BLOCK_DEFAULT)
+            fprintf(stderr, "\tBlock size        ::  %.1f ms, %.1f ms to the encoder\n\n",
+                    1000.0*info.ilen/info.sample_rate, info.olen/48.0);
+        if (s.have_preview)
+            fprintf(stderr, "\tPreview           ::  %.1f s from %.1f s\n\n", s.preview.duration, w.start);
+    }
+
+    start = vac_now();
+
+    while (1) { // Main encoding loop, soxr pulls from the decoder as the encoder needs more
         static char *progress_bar[26] = {
             "[                         ]", "[=                        ]",
             "[==                       ]", "[===                      ]",
@@ -238,38 +672,703 @@ int main(int argc, char **argv)
             "[======================== ]", "[=========================]"
         };
 
-        samples = (*vac_get_samples)(&info, ibuf);
-        soxr_process(sb.resampler, ibuf, samples/info.channels, &idone, obuf, info.olen, &odone);
-        ope_encoder_write_float(ob.enc, obuf, odone);
-
-        end = clock();
-        tot_samples += samples;
-        fprintf(stderr, "\r\tProcessing %s %3.0f%%, %3.fx realtime",
-                progress_bar[25*tot_samples/info.length], 99.99*tot_samples/info.length,
-                (float)tot_samples*CLOCKS_PER_SEC/((float)info.sample_rate*info.channels*(end-start)));
-
-        if (samples < info.ilen*info.channels)
+        if (pl.resampling) {
+            b = next_resampled(&pl, b);
+            out   = b->data;
+            odone = b->len;
+            tot_samples = b->tot_samples;
+            blocks      = b->blocks;
+        } else {
+            if (info.passthrough) {
+                odone = pull_input(&src, (soxr_in_t *)&out, info.olen);
+            } else {
+                out = obuf;
+                odone = resample(&sb, obuf, info.olen);
+            }
+            tot_samples = src.tot_samples;
+            blocks      = src.blocks;
+        }
+        if (!odone)
+            break;
+        odone = clip_window(&w, &out, odone, info.channels*(info.passthrough ? src.sample_size : sizeof(float)));
+        if (!info.passthrough || itype == SOXR_FLOAT32_I) {
+            ope_encoder_write_float(ob.enc, out, odone);
+        } else if (itype == SOXR_INT16_I) {
+            ope_encoder_write(ob.enc, out, odone); // No float conversion at all
+        } else { // 24-bit, 32-bit and FLAC, left-justified in 32 bits
+            vac_s32_to_f32(obuf, out, odone*info.channels);
+            ope_encoder_write_float(ob.enc, obuf, odone);
+        }
+        if (!w.left)
             break;
+
+        if (s.quiet || shown == blocks) // Once per decoded block
+            continue;
+        shown = blocks;
+        end = vac_now();
+        if (info.length && tot_samples <= info.length) {
+            fprintf(stderr, "\r\tProcessing %s %3.0f%%, %3.fx realtime",
+                    progress_bar[25*tot_samples/info.length], 99.99*tot_samples/info.length,
+                    (double)tot_samples/((double)info.sample_rate*info.channels*(end-start)));
+        } else { // Unknown length, e.g. a pipe
+            fprintf(stderr, "\r\tProcessing %.1f s, %3.fx realtime",
+                    (double)tot_samples/((double)info.sample_rate*info.channels),
+                    (double)tot_samples/((double)info.sample_rate*info.channels*(end-start)));
+        }
+    }
+    stop_pipeline(&pl); // Before anything the other stages use is touched or freed
+    if (sb.resampler && soxr_error(sb.resampler)) {
+        fprintf(stderr, "Error resampling: %s\n", soxr_error(sb.resampler));
+        goto cleanup;
     }
-    soxr_process(sb.resampler, NULL, 1, &idone, obuf, info.ilen+info.olen, &odone);
-    ope_encoder_write_float(ob.enc, obuf, odone); // Dirty hack to pad last frame
 
-    end = clock();
-    fprintf(stderr, "\r\tProcessing [=========================] 100%%, %3.fx realtime\n",
-           (float)info.length*CLOCKS_PER_SEC/((float)info.channels*info.sample_rate*(end-start)));
+    end = vac_now();
+    if (!s.quiet) {
+        if (info.length)
+            fprintf(stderr, "\r\tProcessing [=========================] 100%%, %3.fx realtime\n",
+                   (double)src.tot_samples/((double)info.channels*info.sample_rate*(end-start)));
+        else
+            fprintf(stderr, "\r\tProcessing %.1f s, %3.fx realtime\n",
+                   (double)src.tot_samples/((double)info.sample_rate*info.channels),
+                   (double)src.tot_samples/((double)info.channels*info.sample_rate*(end-start)));
 #ifndef WIN_UNICODE // Because Windows terminal will do it regardless
-    fprintf(stderr, "\n");
+        fprintf(stderr, "\n");
 #endif
+    }
 
+    t[4] = vac_now();
     ope_encoder_drain(ob.enc);
-    ope_encoder_destroy(ob.enc);
-    ope_comments_destroy(ob.comments);
-    soxr_delete(sb.resampler);
+    ret = 0;
+
+cleanup:
+
+    if (ob.enc)
+        ope_encoder_destroy(ob.enc);
+    if (ob.comments)
+        ope_comments_destroy(ob.comments);
+    if (sb.resampler)
+        soxr_delete(sb.resampler);
+    vac_resample_delete(sb.fixed);
     free(obuf); free(ibuf);
-    vac_close_file(info.in, info.format);
+    if (vac_close_file(&info))
+        ret = 1;
+
+    if (!ret && s.timings) {
+        t[5] = vac_now();
+        s.timings->open      += t[1]-t[0];
+        s.timings->encoder   += t[2]-t[1];
+        s.timings->resampler += t[3]-t[2];
+        s.timings->encode    += t[4]-t[3];
+        s.timings->drain     += t[5]-t[4];
+        s.timings->files++;
+    }
+
+    return ret;
+}
+
+// Averages over the files encoded, so that batches of clips show what each one costs
+static void print_timings(const Timings *t)
+{
+    const double ms = t->files ? 1000.0/t->files : 0;
+
+    fprintf(stderr, "\tStartup           ::  open %.3f ms, encoder %.3f ms, resampler %.3f ms\n",
+            t->open*ms, t->encoder*ms, t->resampler*ms);
+    fprintf(stderr, "\tThen              ::  encode %.3f ms, drain %.3f ms (mean of %u file%s)\n",
+            t->encode*ms, t->drain*ms, t->files, t->files == 1 ? "" : "s");
+}
+
+static int has_suffix(const char *s, const char *suffix)
+{
+    size_t len = strlen(s), slen = strlen(suffix);
+
+    if (len < slen)
+        return 0;
+    for (size_t i = 0; i < slen; i++)
+        if (tolower((unsigned char)s[len-slen+i]) != suffix[i])
+            return 0;
+    return 1;
+}
+
+// Output path for a tar member, zero for members that are not audio or would escape the output
+static int opus_name(const char *path, int raw, char *name, size_t size)
+{
+    static const char *const compressed[] = { ".gz", ".zst" };
+    static const char *const audio[] = { ".wav", ".wave", ".flac", ".aif", ".aiff", ".aifc", ".caf" };
+    size_t len;
+
+    while (*path == '/')
+        path++;
+    if (!strcmp(path, "..") || !strncmp(path, "../", 3) || strstr(path, "/../") || has_suffix(path, "/.."))
+        return 0;
+    if (snprintf(name, size, "%s", path) >= (int)size)
+        return 0;
+
+    len = strlen(name);
+    for (size_t i = 0; i < sizeof(compressed)/sizeof(*compressed); i++)
+        if (has_suffix(name, compressed[i]))
+            name[len -= strlen(compressed[i])] = '\0';
+    for (size_t i = 0; i < sizeof(audio)/sizeof(*audio); i++) {
+        if (has_suffix(name, audio[i])) {
+            name[len -= strlen(audio[i])] = '\0';
+            raw = 1;
+            break;
+        }
+    }
+    if (!raw || !len || len + sizeof(".opus") > size)
+        return 0;
+    strcpy(name+len, ".opus");
+
+    return 1;
+}
+
+static void make_parents(char *path)
+{
+    for (char *p = strchr(path+1, '/'); p; p = strchr(p+1, '/')) {
+        *p = '\0';
+        mkdir(path, 0777);
+        *p = '/';
+    }
+}
+
+// Encodes every audio member of a tar, into a directory or into another tar
+static int encode_tar(const char *infile, const char *outfile, FileInfo info, Settings s)
+{
+    static const OpusEncCallbacks memory_callbacks = { write_memory, close_memory };
+    const int to_tar = !strcmp(outfile, "-") || has_suffix(outfile, ".tar");
+    FILE *in, *out = NULL;
+    const char *path;
+    uint64_t size;
+    void *tar;
+    int ret = 0;
+
+    if (!strcmp(infile, "-")) {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        in = stdin;
+    } else {
+        in = fopen_utf8(infile, "rb");
+    }
+    if (!in) {
+        fprintf(stderr, "Unable to open input file.\n");
+        return 1;
+    }
+    if (to_tar && !strcmp(outfile, "-")) {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        out = stdout;
+    } else if (to_tar) {
+        out = fopen_utf8(outfile, "wb");
+        if (!out) {
+            fprintf(stderr, "Cannot write to output file: %s\n", outfile);
+            fclose(in);
+            return 1;
+        }
+    }
+    in = vac_decompress_probe(in); // For .tar.gz and .tar.zst
+    if (!in) {
+        fprintf(stderr, "Unable to decompress input file.\n");
+        if (out && out != stdout)
+            fclose(out);
+        return 1;
+    }
+    tar = tar_read_open(in);
+    if (!tar) {
+        fprintf(stderr, "Unable to allocate sufficient memory.\n");
+        if (in != stdin)
+            fclose(in);
+        if (out && out != stdout)
+            fclose(out);
+        return 1;
+    }
+
+    while ((path = tar_read_next(tar, &size))) {
+        char name[4096], dest[4096+1024] = "";
+        MemoryOutput mo = {0};
+        OpusBlock ob = {0};
+        FileInfo member = info;
+
+        if (!opus_name(path, info.raw, name, sizeof(name))) {
+            fprintf(stderr, "Skipping %s\n", path);
+            continue;
+        }
+        fprintf(stderr, "\n%s -> %s\n", path, name);
+
+        if (to_tar) {
+            ob.callbacks = &memory_callbacks;
+            ob.user_data = &mo;
+        } else {
+            snprintf(dest, sizeof(dest), "%s/%s", outfile, name);
+            make_parents(dest);
+        }
+
+        member.stream = tar_member_open(tar);
+        if (!member.stream) {
+            fprintf(stderr, "Unable to read %s from the archive.\n", path);
+            ret = 1;
+            break;
+        }
+        if (encode_file(path, dest, member, ob, s)) {
+            ret = 1;
+        } else if (to_tar && tar_write_member(out, name, mo.data, mo.len)) {
+            fprintf(stderr, "Cannot write to output file: %s\n", outfile);
+            free(mo.data);
+            ret = 1;
+            break;
+        }
+        free(mo.data);
+    }
+
+    if (tar_read_close(tar)) {
+        fprintf(stderr, "Input is not a tar archive, or it is truncated.\n");
+        ret = 1;
+    }
+    if (out) {
+        if (tar_write_end(out)) {
+            fprintf(stderr, "Cannot write to output file: %s\n", outfile);
+            ret = 1;
+        }
+        if (out != stdout)
+            fclose(out);
+    }
+
+    return ret;
+}
+
+// The name an input is written to in the output directory, 0 if it is skipped
+static int batch_name(const char *infile, char *name, size_t size)
+{
+    const char *base = infile;
+
+    for (const char *p = infile; *p; p++)
+        if (*p == '/' || *p == '\\')
+            base = p+1;
+    return opus_name(base, 1, name, size);
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Fails if two inputs, from different directories, would be written to the same file
+static int check_names(const Batch *b)
+{
+    char **names = calloc(b->count ? b->count : 1, sizeof(*names));
+    char name[4096];
+    size_t n = 0;
+    int ret = 0;
+
+    if (!names) {
+        fprintf(stderr, "Unable to allocate sufficient memory.\n");
+        return 1;
+    }
+    for (size_t i = 0; i < b->count && !ret; i++) {
+        if (!batch_name(b->inputs[i], name, sizeof(name)))
+            continue;
+        if (!(names[n++] = strdup(name))) {
+            fprintf(stderr, "Unable to allocate sufficient memory.\n");
+            ret = 1;
+        }
+    }
+    if (!ret)
+        qsort(names, n, sizeof(*names), &compare_names);
+    for (size_t i = 1; i < n && !ret; i++) {
+        if (!strcmp(names[i-1], names[i])) {
+            fprintf(stderr, "More than one input would be written to %s/%s.\n", b->outdir, names[i]);
+            ret = 1;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++)
+        free(names[i]);
+    free(names);
+    return ret;
+}
+
+static int encode_batch_item(void *ctx, size_t i)
+{
+    const Batch *b = ctx;
+    const char *infile = b->inputs[i];
+    char name[4096], dest[4096+1024];
+    OpusBlock ob = {0};
+    Settings s;
+
+    if (!batch_name(infile, name, sizeof(name))) {
+        fprintf(stderr, "Skipping %s\n", infile);
+        return 1;
+    }
+    snprintf(dest, sizeof(dest), "%s/%s", b->outdir, name);
+
+    s = b->s;
+    if (b->timings)
+        s.timings = &b->timings[i];
+    if (encode_file(infile, dest, b->info, ob, s)) {
+        fprintf(stderr, "Failed: %s\n", infile);
+        return 1;
+    }
+    fprintf(stderr, "%s -> %s\n", infile, dest);
+
+    return 0;
+}
+
+// Appends the lines of a file list, - for stdin, to the inputs
+static int read_list(const char *path, char ***inputs, size_t *count)
+{
+    FILE *f = strcmp(path, "-") ? fopen_utf8(path, "r") : stdin;
+    char line[4096];
+
+    if (!f) {
+        fprintf(stderr, "Unable to open file list.\n");
+        return 1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        char **p;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (!*line)
+            continue;
+        p = realloc(*inputs, (*count+1)*sizeof(**inputs));
+        if (!p || !(p[*count] = strdup(line))) {
+            fprintf(stderr, "Unable to allocate sufficient memory.\n");
+            if (p)
+                *inputs = p;
+            if (f != stdin)
+                fclose(f);
+            return 1;
+        }
+        *inputs = p;
+        (*count)++;
+    }
+    if (f != stdin)
+        fclose(f);
+
+    return 0;
+}
+
+// Encodes every input into the output directory, jobs at a time
+static int encode_batch(char **args, size_t nargs, const char *list, const char *outdir,
+                        int jobs, FileInfo info, Settings s)
+{
+    Batch b = { NULL, 0, outdir, info, s, NULL };
+    char dir[4096+2];
+    int ret = 1;
+
+    for (size_t i = 0; i < nargs; i++) {
+        char **p = realloc(b.inputs, (b.count+1)*sizeof(*b.inputs));
+        if (!p || !(p[b.count] = strdup(args[i]))) {
+            fprintf(stderr, "Unable to allocate sufficient memory.\n");
+            if (p)
+                b.inputs = p;
+            goto cleanup;
+        }
+        b.inputs = p;
+        b.count++;
+    }
+    if (list && read_list(list, &b.inputs, &b.count))
+        goto cleanup;
+    for (size_t i = 0; i < b.count; i++) {
+        if (!strcmp(b.inputs[i], "-")) {
+            fprintf(stderr, "Batches cannot read from stdin.\n");
+            goto cleanup;
+        }
+    }
+    if (check_names(&b))
+        goto cleanup;
+
+    snprintf(dir, sizeof(dir), "%s/", outdir);
+    make_parents(dir);
+    b.s.quiet = 1;
+    b.s.threads = b.count < (size_t)jobs ? jobs/(int)b.count : 1; // Cores no job claims go to soxr
+    if (s.timings && !(b.timings = calloc(b.count ? b.count : 1, sizeof(*b.timings)))) {
+        fprintf(stderr, "Unable to allocate sufficient memory.\n");
+        goto cleanup;
+    }
+    ret = vac_pool_run(jobs, b.count, &encode_batch_item, &b);
+    for (size_t i = 0; s.timings && i < b.count; i++) {
+        s.timings->open      += b.timings[i].open;
+        s.timings->encoder   += b.timings[i].encoder;
+        s.timings->resampler += b.timings[i].resampler;
+        s.timings->encode    += b.timings[i].encode;
+        s.timings->drain     += b.timings[i].drain;
+        s.timings->files     += b.timings[i].files;
+    }
+
+cleanup:
+
+    for (size_t i = 0; i < b.count; i++)
+        free(b.inputs[i]);
+    free(b.inputs);
+    free(b.timings);
+
+    return ret;
+}
+
+// Rough CPU seconds per second of audio and channel, for --probe to estimate the cost of an encode
+#define COST_ENCODE   0.004
+#define COST_RESAMPLE 0.002 // At 48 kHz input, scaled by the input rate
+
+static int probe_item(void *ctx, size_t i)
+{
+    const Probe *p = ctx;
+    const char *container, *format;
+    FileInfo info = {0};
+    char name[4096*6+1], *q = name;
+    char frames[32] = "null", duration[32] = "null", cost[32] = "null"; // Unknown if streamed
+    size_t len;
+
+    for (const unsigned char *c = (const unsigned char *)p->inputs[i]; *c && q < name+sizeof(name)-7; c++) {
+        if (*c == '"' || *c == '\\')
+            q += sprintf(q, "\\%c", *c);
+        else if (*c < 0x20)
+            q += sprintf(q, "\\u%04x", *c);
+        else
+            *q++ = *c;
+    }
+    *q = '\0';
+
+    if (vac_probe_file(p->inputs[i], &info, &container)) {
+        len = strlen(name) + 64;
+        if ((p->lines[i] = malloc(len)))
+            snprintf(p->lines[i], len, "{\"file\":\"%s\",\"error\":\"unreadable\"}", name);
+        return 1;
+    }
+
+    switch (info.format) {
+        case 0: // FLAC
+        case 1:  format = "int"; break;
+        case 3:  format = "float"; break;
+        case 6:  format = "alaw"; break;
+        case 7:  format = "ulaw"; break;
+        default: format = "unknown";
+    }
+    if (info.length) {
+        double seconds = (double)info.length/info.channels/info.sample_rate;
+        double per_channel = COST_ENCODE + (info.sample_rate != 48000 && strcmp(container, "ogg") ?
+                                            COST_RESAMPLE*info.sample_rate/48000 : 0);
+        snprintf(frames, sizeof(frames), "%llu", (unsigned long long)(info.length/info.channels));
+        snprintf(duration, sizeof(duration), "%.6f", seconds);
+        snprintf(cost, sizeof(cost), "%.3f", seconds*info.channels*per_channel);
+    }
+
+    len = strlen(name) + 256;
+    p->lines[i] = malloc(len);
+    if (!p->lines[i])
+        return 1;
+    snprintf(p->lines[i], len, "{\"file\":\"%s\",\"container\":\"%s\",\"format\":\"%s\","
+             "\"sample_rate\":%d,\"channels\":%d,\"bit_depth\":%d,\"frames\":%s,"
+             "\"duration\":%s,\"cost\":%s}",
+             name, container, format, info.sample_rate, info.channels, info.bit_depth,
+             frames, duration, cost);
+
+    return 0;
+}
+
+// Prints one JSON line per input, in order, probed jobs at a time
+static int probe_files(char **inputs, size_t count, int jobs)
+{
+    Probe p = { inputs, calloc(count, sizeof(char *)) };
+    int ret;
+
+    if (!p.lines) {
+        fprintf(stderr, "Unable to allocate sufficient memory.\n");
+        return 1;
+    }
+    ret = vac_pool_run(jobs, count, &probe_item, &p);
+    for (size_t i = 0; i < count; i++) {
+        if (p.lines[i])
+            printf("%s\n", p.lines[i]);
+        free(p.lines[i]);
+    }
+    free(p.lines);
+
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+    int ch;
+    int from_tar = 0;
+    int probe = 0;
+    int batch;
+    int jobs = vac_cpu_count();
+    const char *list = NULL;
+    Stems stems = {0};
+    Downmix downmix = {0};
+    float *gains, gain = 1.0f;
+    Settings s = { .vbr_mode = 2 };
+    Timings timings = {0};
+    FileInfo info = {0};
+    OpusBlock ob = {0};
+#ifdef WIN_UNICODE
+    int argc_utf8;
+    char **argv_utf8;
+
+    (void)argc;
+    (void)argv;
+    init_commandline_arguments_utf8(&argc_utf8, &argv_utf8);
+#endif
+
+    static const struct option long_options[] = {
+        { "raw",       required_argument, NULL, 'r' },
+        { "shm",       no_argument,       NULL, 's' },
+        { "from-tar",  no_argument,       NULL, 't' },
+        { "decoder",   required_argument, NULL, 'd' },
+        { "preview",   required_argument, NULL, 'p' },
+        { "jobs",      required_argument, NULL, 'j' },
+        { "list",      required_argument, NULL, 'L' },
+        { "stem",      required_argument, NULL, 'S' },
+        { "gain",      required_argument, NULL, 'g' },
+        { "assign",    no_argument,       NULL, 'A' },
+        { "probe",     no_argument,       NULL, 'P' },
+        { "resampler", required_argument, NULL, 'R' },
+        { "startup-stats", no_argument,   NULL, 'T' },
+        { "downmix",   required_argument, NULL, 'D' },
+        { "channels",  required_argument, NULL, 'C' },
+        { "block",     required_argument, NULL, 'B' },
+        { NULL,        0,                 NULL, 0   }
+    };
+
+    stems.paths = malloc(argc_utf8*sizeof(*stems.paths));
+    stems.gains = gains = malloc(argc_utf8*sizeof(*gains));
+    if (!stems.paths || !gains) {
+        fprintf(stderr, "Unable to allocate sufficient memory.\n");
+        return 1;
+    }
+
+    while ((ch = getopt_long(argc_utf8, argv_utf8, "b:l:v:j:", long_options, NULL)) != -1) {
+        switch (ch) {
+            case 'b':
+                s.bitrate = (opus_int32)(atof(optarg)*1000);
+                s.have_bitrate = 1;
+                break;
+            case 'l':
+                s.lsb = atoi(optarg);
+                s.have_lsb = 1;
+                break;
+            case 'v':
+                s.vbr_mode = atoi(optarg);
+                break;
+            case 'r':
+                if (vac_parse_raw(optarg, &info))
+                    return 1;
+                break;
+            case 's':
+                info.shm = 1;
+                break;
+            case 't':
+                from_tar = 1;
+                break;
+            case 'd':
+                info.command = optarg;
+                break;
+            case 'p':
+                if (vac_parse_preview(optarg, &s.preview))
+                    return 1;
+                s.have_preview = 1;
+                break;
+            case 'j':
+                jobs = atoi(optarg);
+                break;
+            case 'L':
+                list = optarg;
+                break;
+            case 'S':
+                stems.paths[stems.count] = optarg;
+                gains[stems.count++] = gain;
+                gain = 1.0f;
+                break;
+            case 'g':
+                gain = powf(10.0f, (float)atof(optarg)/20);
+                break;
+            case 'A':
+                stems.assign = 1;
+                break;
+            case 'P':
+                probe = 1;
+                break;
+            case 'R':
+                if ((s.recipe = parse_recipe(optarg)) < 0)
+                    return 1;
+                break;
+            case 'T':
+                s.timings = &timings;
+                break;
+            case 'D':
+                if (vac_parse_downmix(optarg, &downmix))
+                    return 1;
+                info.downmix = &downmix;
+                break;
+            case 'C':
+                if (vac_parse_channels(optarg, &downmix))
+                    return 1;
+                info.downmix = &downmix;
+                break;
+            case 'B':
+                if (vac_parse_block(optarg, &info.block))
+                    return 1;
+                break;
+            case '?':
+            default:
+                usage(argv_utf8[0]);
+                return 1;
+        }
+    }
+    if (argc_utf8 - optind < (list || stems.count || probe ? 1 : 2) || from_tar + info.shm + !!info.command > 1 ||
+        (s.have_preview && (from_tar || info.shm)) ||
+        (stems.count && (argc_utf8 - optind > 1 || list || from_tar || info.shm)) ||
+        (probe && (stems.count || list || from_tar || info.shm || info.command || info.raw || s.have_preview ||
+                   info.downmix))) {
+        usage(argv_utf8[0]);
+        return 1;
+    }
+    batch = !probe && (list || argc_utf8 - optind > 2);
+    if (batch && (from_tar || info.shm)) {
+        usage(argv_utf8[0]);
+        return 1;
+    }
+    if (jobs < 1) {
+        fprintf(stderr, "At least one job must run.\n");
+        return 1;
+    }
+
+    for (int i = 0; i < stems.count; i++) {
+        if (strcmp(stems.paths[i], "-") && !strcmp(argv_utf8[argc_utf8-1], stems.paths[i])) {
+            fprintf(stderr, "Input and output file cannot be the same.\n");
+            return 1;
+        }
+    }
+    if (!batch && !stems.count && strcmp(argv_utf8[argc_utf8-2], "-") && !info.shm &&
+        !strcmp(argv_utf8[argc_utf8-1], argv_utf8[argc_utf8-2])) {
+        fprintf(stderr, "Input and output file cannot be the same.\n");
+        return 1;
+    }
+
+    vac_convert_init();
+    vac_resample_init();
+    vac_downmix_init();
+    s.threads = jobs;
+
+    if (probe) {
+        ret = probe_files(argv_utf8+optind, argc_utf8-optind, jobs);
+    } else if (batch) {
+        ret = encode_batch(argv_utf8+optind, argc_utf8-optind-1, list, argv_utf8[argc_utf8-1], jobs, info, s);
+    } else if (stems.count) {
+        info.stems = &stems;
+        ret = encode_file(stems.paths[0], argv_utf8[argc_utf8-1], info, ob, s);
+    } else if (from_tar) {
+        ret = encode_tar(argv_utf8[argc_utf8-2], argv_utf8[argc_utf8-1], info, s);
+    } else {
+        ret = encode_file(argv_utf8[argc_utf8-2], argv_utf8[argc_utf8-1], info, ob, s);
+    }
+    if (s.timings && timings.files)
+        print_timings(&timings);
+    free(stems.paths);
+    free(gains);
 #ifdef WIN_UNICODE
     free_commandline_arguments_utf8(&argc_utf8, &argv_utf8);
 #endif
 
-    return 0;
-}
\ No newline at end of file
+    return ret;
+}
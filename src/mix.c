@@ -0,0 +1,291 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mix.h"
+#include "ring.h"
+
+#define STEM_DEPTH 2 // Blocks per stem, one being mixed while the next is decoded
+
+typedef struct StemBlock {
+    float *pcm;
+    int frames;
+    int last; // The stem ends with this block
+} StemBlock;
+
+typedef struct Stem {
+    FileInfo info;
+    void *ibuf;
+    void *obuf;
+    StemBlock block[STEM_DEPTH];
+    Ring decoded, decoded_free;
+    pthread_t thread;
+    int running;     // Decoding on thread, otherwise into block[0] when mixed
+    StemBlock *cur;  // Being mixed, NULL once the stem has ended
+    float gain;
+    int ended;
+} Stem;
+
+typedef struct Mix {
+    Stem *stem;
+    int count;
+    int assign;
+} Mix;
+
+// Scales n decoded samples to float in the range of ope_encoder_write_float()
+static void to_float(const FileInfo *info, const void *ibuf, float *dst, size_t n, float gain)
+{
+    if (info->format == 3 || info->format == 6 || info->format == 7) {
+        const float *p = ibuf;
+        for (size_t i = 0; i < n; i++)
+            dst[i] = p[i]*gain;
+    } else if (info->format && info->bit_depth <= 16) {
+        const int16_t *p = ibuf;
+        gain /= 32768.0f;
+        for (size_t i = 0; i < n; i++)
+            dst[i] = p[i]*gain;
+    } else { // 24-bit, 32-bit and FLAC, all left-justified in 32 bits
+        const int32_t *p = ibuf;
+        gain /= 2147483648.0f;
+        for (size_t i = 0; i < n; i++)
+            dst[i] = p[i]*gain;
+    }
+}
+
+static void decode_stem(Stem *st, StemBlock *b)
+{
+    int samples = st->info.get_samples(&st->info, st->ibuf);
+
+    if (samples < 0)
+        samples = 0;
+    b->last   = samples < st->info.ilen*st->info.channels;
+    b->frames = samples/st->info.channels;
+    to_float(&st->info, st->ibuf, b->pcm, (size_t)b->frames*st->info.channels, st->gain);
+}
+
+// Decodes a block ahead of the mix, until the stem ends or NULL is handed back
+static void *stem_thread(void *arg)
+{
+    Stem *st = arg;
+    StemBlock *b;
+    int last = 0;
+
+    while (!last && (b = vac_ring_pop(&st->decoded_free))) {
+        decode_stem(st, b);
+        last = b->last;
+        vac_ring_push(&st->decoded, b);
+    }
+
+    return NULL;
+}
+
+static int read_mix(FileInfo *info, void *ibuf)
+{
+    Mix *m = info->in;
+    float *out = ibuf;
+    int frames = 0, offset = 0;
+
+    for (int i = 0; i < m->count; i++) {
+        Stem *st = &m->stem[i];
+
+        if (st->ended) {
+            st->cur = NULL;
+            continue;
+        }
+        if (st->running) {
+            st->cur = vac_ring_pop(&st->decoded);
+        } else {
+            st->cur = &st->block[0];
+            decode_stem(st, st->cur);
+        }
+        st->ended = st->cur->last;
+        if (st->cur->frames > frames)
+            frames = st->cur->frames;
+    }
+    memset(out, 0, (size_t)frames*info->channels*sizeof(float));
+
+    for (int i = 0; i < m->count; i++) {
+        Stem *st = &m->stem[i];
+        const int ch = st->info.channels;
+        const float *pcm;
+        int n;
+
+        if (!st->cur) {
+            offset += m->assign ? ch : 0;
+            continue;
+        }
+        pcm = st->cur->pcm;
+        n   = st->cur->frames;
+        if (m->assign) { // Into its own channels
+            for (int f = 0; f < n; f++)
+                for (int c = 0; c < ch; c++)
+                    out[f*info->channels+offset+c] = pcm[f*ch+c];
+            offset += ch;
+        } else if (ch == info->channels) {
+            for (int j = 0; j < n*ch; j++)
+                out[j] += pcm[j];
+        } else { // Mono, into every channel
+            for (int f = 0; f < n; f++)
+                for (int c = 0; c < info->channels; c++)
+                    out[f*info->channels+c] += pcm[f];
+        }
+        if (st->running)
+            vac_ring_push(&st->decoded_free, st->cur);
+    }
+
+    return frames*info->channels;
+}
+
+static void close_mix(void *in)
+{
+    Mix *m = in;
+
+    for (int i = 0; i < m->count; i++) {
+        Stem *st = &m->stem[i];
+        if (st->running) { // NULL stops the thread, unless the stem has already ended
+            vac_ring_push(&st->decoded_free, NULL);
+            pthread_join(st->thread, NULL);
+        }
+        vac_ring_free(&st->decoded);
+        vac_ring_free(&st->decoded_free);
+        if (st->info.close)
+            vac_close_file(&st->info);
+        free(st->ibuf);
+        free(st->obuf);
+        for (int b = 0; b < STEM_DEPTH; b++)
+            free(st->block[b].pcm);
+    }
+    free(m->stem);
+    free(m);
+}
+
+int vac_mix_open(const Stems *stems, FileInfo *info, void **ibuf, void **obuf)
+{
+    Mix *m = calloc(1, sizeof(*m));
+    int depth;
+
+    *ibuf = *obuf = NULL;
+    if (!m || !(m->stem = calloc(stems->count, sizeof(*m->stem)))) {
+        fprintf(stderr, "Unable to allocate sufficient memory.\n");
+        free(m);
+        return 1;
+    }
+    m->count  = stems->count;
+    m->assign = stems->assign;
+
+    info->channels  = 0;
+    info->length    = 0;
+    info->bit_depth = 0;
+    for (int i = 0; i < m->count; i++) {
+        Stem *st = &m->stem[i];
+
+        st->info = *info;
+        st->info.stems = NULL;
+        st->info.full_blocks = 1;
+        if (i) { // Blocks sized for the first stem, even if auto would size them by channels
+            st->info.block.unit  = BLOCK_FRAMES;
+            st->info.block.value = (unsigned)m->stem[0].info.ilen;
+        }
+        st->gain = stems->gains[i];
+        if (vac_open_file(stems->paths[i], &st->info, &st->ibuf, &st->obuf)) {
+            fprintf(stderr, "Unable to read stem %s\n", stems->paths[i]);
+            st->info.close = NULL;
+            goto fail;
+        }
+        for (int b = 0; b < STEM_DEPTH; b++) {
+            st->block[b].pcm = malloc(st->info.ilen*st->info.channels*sizeof(float));
+            if (!st->block[b].pcm) {
+                fprintf(stderr, "Unable to allocate sufficient memory.\n");
+                goto fail;
+            }
+        }
+        // Room for every block and the NULL that stops the thread
+        if (vac_ring_init(&st->decoded, STEM_DEPTH+1) || vac_ring_init(&st->decoded_free, STEM_DEPTH+1)) {
+            fprintf(stderr, "Unable to allocate sufficient memory.\n");
+            goto fail;
+        }
+
+        if (i && (st->info.sample_rate != m->stem[0].info.sample_rate ||
+                  st->info.ilen != m->stem[0].info.ilen)) {
+            fprintf(stderr, "Stems must all have the same sample rate.\n");
+            goto fail;
+        }
+        if (m->assign)
+            info->channels += st->info.channels;
+        else if (st->info.channels > info->channels)
+            info->channels = st->info.channels;
+        if (st->info.length/st->info.channels > info->length)
+            info->length = st->info.length/st->info.channels;
+        depth = st->info.format == 6 || st->info.format == 7 ? 14 : st->info.bit_depth; // G.711 as in init_encoder()
+        if (depth > info->bit_depth) // The deepest stem sets the encoder's LSB depth
+            info->bit_depth = depth;
+    }
+    for (int i = 0; i < m->count && !m->assign; i++) {
+        if (m->stem[i].info.channels != 1 && m->stem[i].info.channels != info->channels) {
+            fprintf(stderr, "Stems must be mono or all have the same number of channels.\n");
+            goto fail;
+        }
+    }
+    if (info->channels > 255) {
+        fprintf(stderr, "Too many channels.\n");
+        goto fail;
+    }
+
+    info->in          = m;
+    info->close       = &close_mix;
+    info->get_samples = &read_mix;
+    info->seek        = NULL;
+    info->child       = NULL;
+    info->sample_rate = m->stem[0].info.sample_rate;
+    info->format      = 3;
+    info->passthrough = info->sample_rate == 48000;
+    info->length     *= info->channels;
+    info->ilen        = m->stem[0].info.ilen;
+    info->olen        = m->stem[0].info.olen;
+
+    info->ibuf_size   = info->ilen*info->channels*sizeof(float);
+    *ibuf = malloc(info->ibuf_size);
+    *obuf = malloc(info->olen*info->channels*sizeof(float));
+    if (!*ibuf || !*obuf) {
+        fprintf(stderr, "Unable to allocate sufficient memory.\n");
+        free(*ibuf);
+        free(*obuf);
+        *ibuf = *obuf = NULL;
+        close_mix(m);
+        return 1;
+    }
+
+    // Should a thread fail to start, its stem is decoded when the mix is read
+    for (int i = 0; i < m->count; i++) {
+        Stem *st = &m->stem[i];
+        for (int b = 0; b < STEM_DEPTH; b++)
+            vac_ring_push(&st->decoded_free, &st->block[b]);
+        st->running = !pthread_create(&st->thread, NULL, &stem_thread, st);
+    }
+
+    return 0;
+
+fail:
+
+    close_mix(m);
+    return 1;
+}
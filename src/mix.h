@@ -0,0 +1,39 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VAC_MIX_H
+#define VAC_MIX_H
+
+#include "decode.h"
+
+typedef struct Stems { // Inputs mixed into one before the resampler
+    const char **paths;
+    const float *gains; // Linear, one per path
+    int count;
+    int assign; // Stack the channels of each stem instead of summing them
+} Stems;
+
+/*
+* Opens every stem with its own decoder, and fills info so that the mix reads
+* like a single floating-point input. Every stem is decoded a block ahead of the
+* mix on a thread of its own, kept for the whole mix. Stems must share a sample
+* rate; shorter ones are padded with silence.
+*/
+int vac_mix_open(const Stems *stems, FileInfo *info, void **ibuf, void **obuf);
+
+#endif
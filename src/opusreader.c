@@ -0,0 +1,311 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <opus_multistream.h>
+
+#include "opusreader.h"
+#include "unicode_support_wrapper.h"
+
+#define MAX_FRAME 5760 // 120 ms at 48 kHz
+#define MAX_PAGE  65307
+
+#define PAGE_CONTINUED 1
+#define PAGE_EOS       4
+
+struct opus_reader {
+    FILE *ogg;
+    OpusMSDecoder *dec;
+    uint32_t serial;
+    int channels;
+    int preskip;       // Samples still to be dropped from the start
+    uint64_t length;
+    int64_t granule;   // Position reached by the decoder, pre-skip included
+
+    unsigned char page[MAX_PAGE];
+    int segments;      // Lacing values in the current page
+    int segment;       // Next lacing value to consume
+    int body;          // Offset of the next packet byte in page
+    int flags;
+    int64_t page_granule;
+    int done;
+
+    unsigned char *packet;
+    int packet_len;
+    int packet_size;
+
+    float *pcm;
+    int pcm_pos;       // Decoded samples per channel not handed out yet
+    int pcm_len;
+};
+
+static uint32_t le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int64_t le64(const unsigned char *p)
+{
+    return (int64_t)((uint64_t)le32(p+4) << 32 | le32(p));
+}
+
+// Reads the next page of any stream, or returns 0 at the end of the file
+static int read_page(struct opus_reader *or)
+{
+    unsigned char *p = or->page;
+    int len = 0;
+
+    if (fread(p, 1, 27, or->ogg) != 27 || memcmp(p, "OggS", 4) || p[4] ||
+        fread(p+27, 1, p[26], or->ogg) != p[26])
+        return 0;
+    for (int i = 0; i < p[26]; i++)
+        len += p[27+i];
+    if (fread(p+27+p[26], 1, len, or->ogg) != (size_t)len)
+        return 0;
+
+    or->segments     = p[26];
+    or->segment      = 0;
+    or->body         = 27 + p[26];
+    or->flags        = p[5];
+    or->page_granule = le64(p+6);
+
+    return 1;
+}
+
+// Whether no other packet ends on the current page, so its granule position is ours
+static int last_on_page(const struct opus_reader *or)
+{
+    for (int i = or->segment; i < or->segments; i++)
+        if (or->page[27+i] < 255)
+            return 0;
+    return 1;
+}
+
+// Assembles the next packet of our stream, returns 0 at the end
+static int read_packet(struct opus_reader *or, int *last)
+{
+    or->packet_len = 0;
+
+    while (1) {
+        while (or->segment < or->segments) {
+            int lace = or->page[27+or->segment++];
+            if (or->packet_len + lace > or->packet_size) {
+                unsigned char *packet = realloc(or->packet, or->packet_len + lace + MAX_PAGE);
+                if (!packet)
+                    return 0;
+                or->packet      = packet;
+                or->packet_size = or->packet_len + lace + MAX_PAGE;
+            }
+            memcpy(or->packet+or->packet_len, or->page+or->body, lace);
+            or->packet_len += lace;
+            or->body       += lace;
+            if (lace < 255) {
+                *last = last_on_page(or);
+                return 1;
+            }
+        }
+        if (or->flags & PAGE_EOS && or->serial == le32(or->page+14))
+            return 0;
+        do {
+            if (!read_page(or))
+                return 0;
+        } while (le32(or->page+14) != or->serial);
+    }
+}
+
+// Final granule position, found by scanning the tail of the file for our last page
+static uint64_t find_length(struct opus_reader *or)
+{
+    int64_t pos = ftell_64(or->ogg), end, start;
+    unsigned char *tail;
+    size_t n;
+    int64_t granule = -1;
+
+    if (pos < 0 || fseek_64(or->ogg, 0, SEEK_END) || (end = ftell_64(or->ogg)) < 0)
+        return 0;
+    start = end > MAX_PAGE ? end - MAX_PAGE : 0;
+    tail = malloc(end - start);
+    if (tail && !fseek_64(or->ogg, start, SEEK_SET)) {
+        n = fread(tail, 1, end - start, or->ogg);
+        for (size_t i = 0; i + 27 <= n; i++)
+            if (!memcmp(tail+i, "OggS", 4) && le32(tail+i+14) == or->serial && le64(tail+i+6) >= 0)
+                granule = le64(tail+i+6);
+    }
+    free(tail);
+    fseek_64(or->ogg, pos, SEEK_SET);
+
+    if (granule < or->preskip)
+        return 0;
+    return granule - or->preskip;
+}
+
+// Parses OpusHead and OpusTags, leaves channels at zero if they are not there
+static void read_headers(struct opus_reader *or, unsigned char *mapping, int *streams, int *coupled, int *gain)
+{
+    int last;
+
+    // The first page must start our stream with OpusHead
+    if (!read_page(or) || !(or->flags & 2) || or->segments < 1)
+        return;
+    or->serial = le32(or->page+14);
+    if (!read_packet(or, &last) || or->packet_len < 19 || memcmp(or->packet, "OpusHead", 8) ||
+        (or->packet[8] & 0xf0))
+        return;
+
+    or->channels = or->packet[9];
+    or->preskip  = or->packet[10] | or->packet[11] << 8;
+    *gain        = (int16_t)(or->packet[16] | or->packet[17] << 8);
+    *coupled     = or->channels > 1;
+    if (or->packet[18]) { // Mapping family
+        if (or->packet_len < 21 + or->channels) {
+            or->channels = 0;
+            return;
+        }
+        *streams = or->packet[19];
+        *coupled = or->packet[20];
+        memcpy(mapping, or->packet+21, or->channels);
+    }
+
+    if (!or->channels || !read_packet(or, &last) || or->packet_len < 8 ||
+        memcmp(or->packet, "OpusTags", 8))
+        or->channels = 0;
+}
+
+void *opus_read_open(FILE *ogg)
+{
+    struct opus_reader *or = malloc(sizeof(*or));
+    unsigned char mapping[255] = { 0, 1 };
+    int streams = 1, coupled, gain, err;
+
+    if (!or)
+        return NULL;
+    memset(or, 0, sizeof(*or));
+    or->ogg = ogg;
+
+    read_headers(or, mapping, &streams, &coupled, &gain);
+    if (!or->channels)
+        return or;
+
+    or->dec = opus_multistream_decoder_create(48000, or->channels, streams, coupled, mapping, &err);
+    or->pcm = malloc(MAX_FRAME*or->channels*sizeof(float));
+    if (!or->dec || !or->pcm) {
+        or->channels = 0;
+        return or;
+    }
+    opus_multistream_decoder_ctl(or->dec, OPUS_SET_GAIN(gain)); // Q7.8 dB, as stored in OpusHead
+    or->length = find_length(or);
+
+    return or;
+}
+
+void opus_read_close(void *obj)
+{
+    struct opus_reader *or = obj;
+
+    if (or->dec)
+        opus_multistream_decoder_destroy(or->dec);
+    if (or->ogg != stdin)
+        fclose(or->ogg);
+    free(or->packet);
+    free(or->pcm);
+    free(or);
+}
+
+int opus_probe(FILE *ogg, int *channels, uint64_t *length)
+{
+    struct opus_reader *or = malloc(sizeof(*or));
+    unsigned char mapping[255];
+    int streams, coupled, gain;
+
+    if (!or) {
+        if (ogg != stdin)
+            fclose(ogg);
+        return 0;
+    }
+    memset(or, 0, sizeof(*or));
+    or->ogg = ogg;
+
+    read_headers(or, mapping, &streams, &coupled, &gain);
+    *channels = or->channels;
+    *length   = or->channels ? find_length(or) : 0;
+    opus_read_close(or);
+
+    return *channels != 0;
+}
+
+int opus_get_header(void *obj, int *channels, uint64_t *length)
+{
+    struct opus_reader *or = obj;
+
+    *channels = or->channels;
+    *length   = or->length;
+
+    return or->channels > 0;
+}
+
+// Decodes one packet into pcm, dropping pre-skip at the start and padding at the end
+static int decode_packet(struct opus_reader *or)
+{
+    int last, n, skip;
+
+    if (or->done || !read_packet(or, &last))
+        return 0;
+    n = opus_multistream_decode_float(or->dec, or->packet, or->packet_len, or->pcm, MAX_FRAME, 0);
+    if (n < 0) {
+        fprintf(stderr, "Corrupt Opus packet: %s\n", opus_strerror(n));
+        or->done = 1;
+        return 0;
+    }
+    or->granule += n;
+
+    // Only the end of the stream may be trimmed, by a granule position short of what was decoded
+    if (last && or->flags & PAGE_EOS && or->page_granule >= 0 && or->granule > or->page_granule) {
+        n -= or->granule - or->page_granule < n ? or->granule - or->page_granule : n;
+        or->done = 1;
+    }
+
+    skip = or->preskip < n ? or->preskip : n;
+    or->preskip -= skip;
+    or->pcm_pos  = skip;
+    or->pcm_len  = n;
+
+    return 1;
+}
+
+int opus_read_float(void *obj, float *pcm, int frames)
+{
+    struct opus_reader *or = obj;
+    int done = 0;
+
+    while (done < frames) {
+        int n;
+        if (or->pcm_pos == or->pcm_len && !decode_packet(or))
+            break;
+        n = or->pcm_len - or->pcm_pos;
+        if (n > frames - done)
+            n = frames - done;
+        memcpy(pcm + done*or->channels, or->pcm + or->pcm_pos*or->channels, n*or->channels*sizeof(float));
+        or->pcm_pos += n;
+        done        += n;
+    }
+
+    return done;
+}
@@ -0,0 +1,41 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VAC_OPUSREADER_H
+#define VAC_OPUSREADER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+* Ogg Opus input, decoded to 48 kHz float with pre-skip, end trimming and
+* the output gain from OpusHead applied. Only the first logical stream of
+* the file is read.
+*/
+
+void *opus_read_open(FILE *ogg);
+void opus_read_close(void *obj);
+
+// length is in samples per channel, zero if the stream cannot be seeked to its last page
+int opus_get_header(void *obj, int *channels, uint64_t *length);
+
+// The same from the headers and the last page alone, without a decoder; closes ogg
+int opus_probe(FILE *ogg, int *channels, uint64_t *length);
+int opus_read_float(void *obj, float *pcm, int frames);
+
+#endif
@@ -0,0 +1,151 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <unistd.h>
+#endif
+#if !defined(_WIN32) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define VAC_CPUID 1
+# include <cpuid.h>
+#endif
+
+#include "pool.h"
+
+typedef struct Pool {
+    int (*fn)(void *, size_t);
+    void *ctx;
+    size_t next;
+    size_t count;
+    int failed;
+    pthread_mutex_t lock;
+} Pool;
+
+static void *worker(void *arg)
+{
+    Pool *p = arg;
+
+    while (1) {
+        size_t i;
+
+        pthread_mutex_lock(&p->lock);
+        i = p->next < p->count ? p->next++ : p->count;
+        pthread_mutex_unlock(&p->lock);
+        if (i == p->count)
+            break;
+
+        if (p->fn(p->ctx, i)) {
+            pthread_mutex_lock(&p->lock);
+            p->failed = 1;
+            pthread_mutex_unlock(&p->lock);
+        }
+    }
+
+    return NULL;
+}
+
+int vac_pool_run(int jobs, size_t count, int (*fn)(void *ctx, size_t i), void *ctx)
+{
+    Pool p = { .fn = fn, .ctx = ctx, .count = count };
+    pthread_t *threads = NULL;
+    int started = 0;
+
+    if (jobs < 1)
+        jobs = 1;
+    if ((size_t)jobs > count)
+        jobs = count ? count : 1;
+    pthread_mutex_init(&p.lock, NULL);
+
+    // The calling thread is one of the workers, so a failed spawn only means fewer of them
+    if (jobs > 1)
+        threads = malloc((jobs-1)*sizeof(*threads));
+    if (threads)
+        for (; started < jobs-1; started++)
+            if (pthread_create(&threads[started], NULL, &worker, &p))
+                break;
+    worker(&p);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+    pthread_mutex_destroy(&p.lock);
+
+    return p.failed;
+}
+
+int vac_cpu_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO si;
+
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+size_t vac_cache_size(void)
+{
+#ifdef _WIN32
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION buf[64];
+    DWORD len = sizeof(buf);
+
+    if (GetLogicalProcessorInformation(buf, &len))
+        for (DWORD i = 0; i < len/sizeof(*buf); i++)
+            if (buf[i].Relationship == RelationCache && buf[i].Cache.Level == 2)
+                return buf[i].Cache.Size;
+#else
+# ifdef _SC_LEVEL2_CACHE_SIZE
+    long n = sysconf(_SC_LEVEL2_CACHE_SIZE);
+
+    if (n > 0)
+        return n;
+# endif
+# ifdef VAC_CPUID
+    unsigned a, b, c, d;
+
+    if (__get_cpuid(0x80000006, &a, &b, &c, &d) && c >> 16) // L2 size in KiB, on Intel and AMD alike
+        return (size_t)(c >> 16) << 10;
+# endif
+#endif
+    return 0;
+}
+
+double vac_now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER t, f;
+
+    QueryPerformanceCounter(&t);
+    QueryPerformanceFrequency(&f);
+    return (double)t.QuadPart/f.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+#endif
+}
@@ -0,0 +1,35 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VAC_POOL_H
+#define VAC_POOL_H
+
+#include <stddef.h>
+
+// Calls fn(ctx, i) for every i below count on up to jobs threads, nonzero if any call failed
+int vac_pool_run(int jobs, size_t count, int (*fn)(void *ctx, size_t i), void *ctx);
+
+int vac_cpu_count(void);
+
+// Per-core L2 cache in bytes, 0 if unknown
+size_t vac_cache_size(void);
+
+// Monotonic wall-clock seconds, comparable across threads
+double vac_now(void);
+
+#endif
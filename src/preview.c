@@ -0,0 +1,165 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "preview.h"
+
+#define PREVIEW_BINS_PER_SECOND 10 // Resolution of the loudness search
+#define PREVIEW_PREROLL         10 // 1/10 s decoded ahead of the window for the resampler to settle
+
+int vac_parse_preview(const char *spec, Preview *p)
+{
+    const char *colon = strrchr(spec, ':');
+    char *end;
+
+    memset(p, 0, sizeof(*p));
+    if (colon) {
+        p->duration = strtod(colon+1, &end);
+        if (*end || end == colon+1)
+            colon = NULL;
+    }
+    if (colon && colon-spec == 7 && !strncmp(spec, "loudest", 7)) {
+        p->loudest = 1;
+    } else if (colon) {
+        p->offset = strtod(spec, &end);
+        if (end != colon || p->offset < 0)
+            colon = NULL;
+    }
+    if (!colon || p->duration <= 0) {
+        fprintf(stderr, "Previews must be given as offset:duration or loudest:duration, in seconds.\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+// Sum of squares of n samples starting at sample i, relative to full scale
+static double energy(const FileInfo *info, const void *ibuf, size_t i, size_t n)
+{
+    double sum = 0;
+
+    if (info->format == 3 || info->format == 6 || info->format == 7) {
+        const float *p = (const float *)ibuf+i;
+        for (size_t j = 0; j < n; j++)
+            sum += (double)p[j]*p[j];
+    } else if (info->format && info->bit_depth <= 16) {
+        const int16_t *p = (const int16_t *)ibuf+i;
+        for (size_t j = 0; j < n; j++)
+            sum += (double)p[j]*p[j];
+        sum /= 32768.0*32768.0;
+    } else { // 24-bit, 32-bit and FLAC, all left-justified in 32 bits
+        const int32_t *p = (const int32_t *)ibuf+i;
+        for (size_t j = 0; j < n; j++)
+            sum += (double)p[j]*p[j];
+        sum /= 2147483648.0*2147483648.0;
+    }
+
+    return sum;
+}
+
+// Reads the whole input once and returns the first frame of the loudest window
+static int find_loudest(FileInfo *info, void *ibuf, double duration, uint64_t *frame)
+{
+    const size_t bin_frames = info->sample_rate/PREVIEW_BINS_PER_SECOND ? info->sample_rate/PREVIEW_BINS_PER_SECOND : 1;
+    const size_t bin = bin_frames*info->channels;
+    const size_t window = duration*PREVIEW_BINS_PER_SECOND > 1 ? duration*PREVIEW_BINS_PER_SECOND : 1;
+    size_t count = 0, size = 0, fill = 0, best = 0;
+    double *bins = NULL, cur = 0, sum = 0, best_sum;
+    int samples;
+
+    do {
+        samples = info->get_samples(info, ibuf);
+        for (size_t i = 0; i < (size_t)samples; ) {
+            size_t n = bin-fill < samples-i ? bin-fill : samples-i;
+
+            cur += energy(info, ibuf, i, n);
+            fill += n;
+            i += n;
+            if (fill < bin)
+                continue;
+            if (count == size) {
+                double *b = realloc(bins, (size = size ? 2*size : 1024)*sizeof(*bins));
+                if (!b) {
+                    fprintf(stderr, "Unable to allocate sufficient memory.\n");
+                    free(bins);
+                    return 1;
+                }
+                bins = b;
+            }
+            bins[count++] = cur;
+            cur = fill = 0;
+        }
+    } while (samples == info->ilen*info->channels);
+
+    // Sliding sum over the bins, a window longer than the input starts at the beginning
+    for (size_t i = 0; i < count && i < window; i++)
+        sum += bins[i];
+    best_sum = sum;
+    for (size_t i = window; i < count; i++) {
+        sum += bins[i] - bins[i-window];
+        if (sum > best_sum) {
+            best_sum = sum;
+            best = i-window+1;
+        }
+    }
+    free(bins);
+    *frame = (uint64_t)best*bin_frames;
+
+    return 0;
+}
+
+int vac_preview_seek(FileInfo *info, void *ibuf, Preview p, PreviewWindow *w)
+{
+    const uint64_t preroll = info->passthrough ? 0 : info->sample_rate/PREVIEW_PREROLL;
+    uint64_t start, reached;
+
+    if (!info->seek)
+        goto unseekable;
+    if (p.loudest) {
+        if (find_loudest(info, ibuf, p.duration, &start))
+            return 1;
+    } else {
+        start = p.offset*info->sample_rate;
+    }
+
+    reached = start > preroll ? start-preroll : 0;
+    if (info->seek(info, &reached))
+        goto unseekable;
+
+    w->drop  = ((start-reached)*48000 + info->sample_rate/2)/info->sample_rate;
+    w->left  = p.duration*48000;
+    w->start = (double)start/info->sample_rate;
+
+    // Only what is decoded counts towards the progress bar
+    if (info->length) {
+        uint64_t needed = (start-reached + (uint64_t)(p.duration*info->sample_rate))*info->channels;
+        info->length = info->length > reached*info->channels ? info->length - reached*info->channels : 0;
+        if (info->length > needed)
+            info->length = needed;
+    }
+
+    return 0;
+
+unseekable:
+
+    fprintf(stderr, "Previews can only be cut from seekable WAVE or FLAC input.\n");
+    return 1;
+}
@@ -0,0 +1,49 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VAC_PREVIEW_H
+#define VAC_PREVIEW_H
+
+#include <stdint.h>
+
+#include "decode.h"
+
+typedef struct Preview {
+    double offset;   // Seconds into the input
+    double duration; // Seconds
+    int loudest;     // Start where the input is loudest instead of at offset
+} Preview;
+
+typedef struct PreviewWindow { // In 48 kHz output frames
+    uint64_t drop; // Resampler pre-roll, decoded but not written
+    uint64_t left; // Still to be written
+    double start;  // Seconds, where the preview begins
+} PreviewWindow;
+
+// Parses offset:duration or loudest:duration, both in seconds
+int vac_parse_preview(const char *spec, Preview *p);
+
+/*
+* Seeks info to just before the preview, so that only the window and a short
+* pre-roll for the resampler are decoded. For loudest, the input is read once
+* beforehand, without resampling or encoding, to find the window with the
+* most energy.
+*/
+int vac_preview_seek(FileInfo *info, void *ibuf, Preview p, PreviewWindow *w);
+
+#endif
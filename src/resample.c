@@ -0,0 +1,563 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "resample.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define VAC_X86 1
+# include <immintrin.h>
+#endif
+
+#ifndef M_PI
+# define M_PI 3.14159265358979323846
+#endif
+
+#define MAX_PRECISION  24   // Bits, float coefficients and sums give no more
+#define MAX_BANKS      16
+#define HALFBAND_BLOCK 8192 // Input frames pulled at once, so that every stage stays in cache
+#define MAX_STAGES     3
+#define MAX_PHASES     640    // 11.025 kHz, the most any common rate needs
+#define MAX_POLY_RATE  192000 // Above, taps per output grow past what soxr costs
+
+typedef struct Bank { // Filter for one stage, shared by every instance with the same parameters
+    int in_rate;
+    double precision;
+    double passband_end;
+    int up, down; // in_rate*up/down is the stage's output rate
+    int taps;     // Per phase, a multiple of 8
+    float *coefs; // up rows of taps, in input order; for half-bands only the odd taps
+} Bank;
+
+typedef struct Stage { // Half-band decimator, its input split into even and odd samples
+    const Bank *bank;
+    float *even, *odd; // Per channel, size apart
+    size_t size;
+    int64_t base;      // Pair even[0], odd[0] holds
+    size_t pairs;      // Pairs held
+    int pending;       // An even sample waits in even[pairs] for its odd one
+    int64_t next;      // Next output, needs pairs up to next+taps/2-1
+} Stage;
+
+struct Resampler {
+    int channels;
+    soxr_datatype_t itype;
+    soxr_input_fn_t fn;
+    void *state;
+    size_t max_ilen;
+    uint64_t in_total;
+    uint64_t out_total;
+    int eof;
+
+    // Polyphase, when bank is set
+    const Bank *bank;
+    float *x;       // Per channel history, size frames apart
+    size_t size;
+    int64_t base;   // Input frame x[0] holds
+    size_t have;    // Frames held
+    int64_t next;   // Newest input frame the next output needs
+    int phase;
+
+    // Half-band cascade otherwise
+    Stage stage[MAX_STAGES];
+    int stages;
+    float *block;   // Planar input, then each stage's output, block_size apart
+    size_t block_size;
+    float *ready;   // Planar output of the last stage
+    size_t ready_len, ready_pos;
+};
+
+static float (*dot)(const float *a, const float *b, size_t n);
+
+static Bank banks[MAX_BANKS];
+static int nbanks;
+static pthread_mutex_t banks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static float dot_c(const float *a, const float *b, size_t n)
+{
+    float sum = 0;
+
+    for (size_t i = 0; i < n; i++)
+        sum += a[i]*b[i];
+    return sum;
+}
+
+#ifdef VAC_X86
+
+__attribute__((target("sse")))
+static float dot_sse(const float *a, const float *b, size_t n)
+{
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+
+    for (size_t i = 0; i < n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a+i+4), _mm_loadu_ps(b+i+4)));
+    }
+    acc0 = _mm_add_ps(acc0, acc1);
+    acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+    acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+    return _mm_cvtss_f32(acc0);
+}
+
+__attribute__((target("avx2,fma")))
+static float dot_fma(const float *a, const float *b, size_t n)
+{
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m128 sum;
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i+8), _mm256_loadu_ps(b+i+8), acc1);
+    }
+    if (i < n)
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i), acc0);
+    acc0 = _mm256_add_ps(acc0, acc1);
+    sum = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+#endif
+
+void vac_resample_init(void)
+{
+    dot = &dot_c;
+#ifdef VAC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse"))
+        dot = &dot_sse;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        dot = &dot_fma;
+#endif
+}
+
+static double bessel_i0(double x)
+{
+    double sum = 1, term = 1;
+
+    for (int k = 1; term > sum*1e-12; k++) {
+        term *= (x/(2*k))*(x/(2*k));
+        sum  += term;
+    }
+    return sum;
+}
+
+// Kaiser-windowed sinc at in_rate*up, split into up phases
+static int design_polyphase(Bank *b)
+{
+    double proto = (double)b->in_rate*b->up;
+    double nyquist = (b->in_rate < 48000 ? b->in_rate : 48000)/2.0;
+    double pass = b->passband_end*nyquist, cutoff = (pass+nyquist)/2/proto;
+    double atten = b->precision*6.02, beta = 0.1102*(atten-8.7);
+    double len = (atten-7.95)/(2.285*2*M_PI*(nyquist-pass)/proto) + 1;
+    double center;
+
+    b->taps  = ((int)ceil(len/b->up) + 7) & ~7;
+    b->coefs = malloc((size_t)b->up*b->taps*sizeof(float));
+    if (!b->coefs)
+        return 1;
+    center = (double)b->up*b->taps/2;
+
+    for (int m = 0; m < b->up*b->taps; m++) {
+        double t = m-center, w = t/center;
+        double h = t ? sin(2*M_PI*cutoff*t)/(M_PI*t) : 2*cutoff;
+        h *= bessel_i0(beta*sqrt(1-w*w))/bessel_i0(beta)*b->up; // Each phase then has unity gain
+        b->coefs[(m % b->up)*b->taps + b->taps-1 - m/b->up] = (float)h;
+    }
+
+    return 0;
+}
+
+/*
+* Half-band: the cutoff sits at a quarter of in_rate, every even tap but the
+* centre one is zero and the centre one is 1/2, so only the odd taps are kept.
+* The passband ends at passband_end of the final 24 kHz and the stopband
+* mirrors it around the cutoff, so aliases land above the passband only.
+*/
+static int design_halfband(Bank *b)
+{
+    double pass = b->passband_end*24000, stop = b->in_rate/2.0-pass;
+    double atten = b->precision*6.02, beta = 0.1102*(atten-8.7);
+    double len = (atten-7.95)/(2.285*2*M_PI*(stop-pass)/b->in_rate) + 1;
+    double sum = 0;
+    int half = ((int)ceil((len+1)/4) + 3) & ~3; // Odd taps on each side
+
+    b->taps  = 2*half;
+    b->coefs = malloc(b->taps*sizeof(float));
+    if (!b->coefs)
+        return 1;
+
+    for (int j = 0; j < b->taps; j++) {
+        double t = 2*j-(b->taps-1), w = t/b->taps;
+        b->coefs[j] = (float)(sin(M_PI*t/2)/(M_PI*t)*bessel_i0(beta*sqrt(1-w*w))/bessel_i0(beta));
+        sum += b->coefs[j];
+    }
+    for (int j = 0; j < b->taps; j++) // Unity gain at DC with the centre tap
+        b->coefs[j] *= 0.5/sum;
+
+    return 0;
+}
+
+// Designed under the lock on first use, then shared
+static const Bank *get_bank(int in_rate, int up, int down, double precision, double passband_end)
+{
+    const Bank *found = NULL;
+
+    pthread_mutex_lock(&banks_lock);
+    for (int i = 0; i < nbanks && !found; i++)
+        if (banks[i].in_rate == in_rate && banks[i].up == up && banks[i].down == down &&
+            banks[i].precision == precision && banks[i].passband_end == passband_end)
+            found = &banks[i];
+    if (!found && nbanks < MAX_BANKS) {
+        Bank *b = &banks[nbanks];
+
+        b->in_rate      = in_rate;
+        b->up           = up;
+        b->down         = down;
+        b->precision    = precision;
+        b->passband_end = passband_end;
+        if (!(up == 1 && down == 2 ? design_halfband(b) : design_polyphase(b)))
+            found = &banks[nbanks++];
+    }
+    pthread_mutex_unlock(&banks_lock);
+
+    return found;
+}
+
+Resampler *vac_resample_create(int in_rate, int channels, soxr_datatype_t itype,
+                               double precision, double passband_end)
+{
+    Resampler *r;
+    int stages = 0, g = in_rate, rest = 48000;
+
+    if (precision > MAX_PRECISION || in_rate <= 0) // Archival stays on soxr
+        return NULL;
+    if (itype != SOXR_INT16_I && itype != SOXR_INT32_I && itype != SOXR_FLOAT32_I)
+        return NULL;
+    while (in_rate >> stages > 48000 && !(in_rate >> stages & 1) && stages < MAX_STAGES)
+        stages++;
+    while (rest) { // Greatest common divisor, for the polyphase ratio
+        int t = g % rest;
+        g = rest;
+        rest = t;
+    }
+    if (in_rate >> stages != 48000 && (48000/g > MAX_PHASES || in_rate > MAX_POLY_RATE))
+        return NULL;
+
+    r = calloc(1, sizeof(*r));
+    if (!r)
+        return NULL;
+    r->channels = channels;
+    r->itype    = itype;
+    r->stages   = in_rate >> stages == 48000 ? stages : 0;
+
+    for (int i = 0; i < r->stages; i++)
+        if (!(r->stage[i].bank = get_bank(in_rate >> i, 1, 2, precision, passband_end)))
+            goto fail;
+    if (!r->stages && !(r->bank = get_bank(in_rate, 48000/g, in_rate/g, precision, passband_end)))
+        goto fail;
+
+    return r;
+
+fail:
+
+    free(r);
+    return NULL;
+}
+
+// Scales n interleaved frames of data into planar floats, stride apart
+static void to_planar(const Resampler *r, float *dst, size_t stride, const void *data, size_t n)
+{
+    for (int c = 0; c < r->channels; c++, dst += stride) {
+        if (!data) {
+            memset(dst, 0, n*sizeof(float));
+        } else if (r->itype == SOXR_INT16_I) {
+            const int16_t *p = (const int16_t *)data + c;
+            for (size_t i = 0; i < n; i++)
+                dst[i] = p[i*r->channels]*(1.0f/32768.0f);
+        } else if (r->itype == SOXR_INT32_I) {
+            const int32_t *p = (const int32_t *)data + c;
+            for (size_t i = 0; i < n; i++)
+                dst[i] = p[i*r->channels]*(1.0f/2147483648.0f);
+        } else {
+            const float *p = (const float *)data + c;
+            for (size_t i = 0; i < n; i++)
+                dst[i] = p[i*r->channels];
+        }
+    }
+}
+
+static int setup_halfband(Resampler *r)
+{
+    size_t in = 0, total = 0;
+
+    // Also holds the silence flushed at the end, every stage's look-ahead in input frames
+    for (int i = 0; i < r->stages; i++)
+        in += (size_t)r->stage[i].bank->taps << i;
+    r->block_size = in = (in > HALFBAND_BLOCK ? in : HALFBAND_BLOCK) + (1 << r->stages);
+
+    for (int i = 0; i < r->stages; i++) {
+        Stage *st = &r->stage[i];
+        const int half = st->bank->taps/2;
+
+        st->size = in/2 + 2*half + 2;
+        st->base = -half; // Starts with half pairs of silence
+        st->pairs = half;
+        st->pending = 0;
+        st->next = 0;
+        in = st->size;
+        total += 2*st->size;
+    }
+    r->ready_len = r->ready_pos = 0;
+
+    r->block = calloc((r->block_size + total + in)*r->channels, sizeof(float));
+    if (!r->block)
+        return 1;
+    for (int i = 0; i < r->stages; i++) {
+        Stage *st = &r->stage[i];
+        float *prev = i ? r->stage[i-1].odd + r->stage[i-1].size*r->channels : r->block + r->block_size*r->channels;
+
+        st->even = prev;
+        st->odd  = prev + st->size*r->channels;
+    }
+    r->ready = r->stage[r->stages-1].odd + r->stage[r->stages-1].size*r->channels;
+
+    return 0;
+}
+
+int vac_resample_set_input_fn(Resampler *r, soxr_input_fn_t fn, void *state, size_t max_ilen)
+{
+    r->fn       = fn;
+    r->state    = state;
+    r->max_ilen = max_ilen;
+
+    if (r->stages) {
+        free(r->block);
+        r->block = NULL;
+        return setup_halfband(r);
+    }
+
+    r->size = max_ilen + 2*r->bank->taps;
+    free(r->x);
+    r->x = calloc(r->size*r->channels, sizeof(float));
+    if (!r->x)
+        return 1;
+
+    // Start with taps-1 frames of silence, centred on the first input frame
+    r->base  = 1-r->bank->taps;
+    r->have  = r->bank->taps-1;
+    r->next  = r->bank->taps/2;
+    r->phase = 0;
+
+    return 0;
+}
+
+// Drops what no output needs any more, then appends n frames of data, or silence if data is NULL
+static void append(Resampler *r, const void *data, size_t n)
+{
+    const int taps = r->bank->taps;
+    const size_t drop = r->next-(taps-1)-r->base;
+
+    for (int c = 0; c < r->channels; c++) {
+        float *x = r->x + c*r->size;
+        memmove(x, x+drop, (r->have-drop)*sizeof(float));
+    }
+    to_planar(r, r->x + r->have-drop, r->size, data, n);
+    r->base += drop;
+    r->have += n-drop;
+}
+
+static size_t output_polyphase(Resampler *r, float *out, size_t olen)
+{
+    const Bank *b = r->bank;
+    size_t done = 0;
+
+    if (!r->x)
+        return 0;
+
+    while (done < olen) {
+        const float *coefs;
+        size_t start;
+
+        if (r->eof && r->out_total >= (r->in_total*b->up + b->down-1)/b->down)
+            break; // Everything flushed
+        if (r->next >= r->base + (int64_t)r->have) {
+            soxr_in_t data = NULL;
+            size_t n = 0;
+
+            if (!r->eof) {
+                n = r->fn(r->state, &data, r->max_ilen);
+                r->eof = !n || !data;
+            }
+            if (r->eof) // Silence to flush the filter with
+                n = b->taps;
+            append(r, r->eof ? NULL : data, n);
+            if (!r->eof)
+                r->in_total += n;
+            continue;
+        }
+
+        coefs = b->coefs + (size_t)r->phase*b->taps;
+        start = r->next-(b->taps-1)-r->base;
+        for (int c = 0; c < r->channels; c++)
+            out[done*r->channels + c] = dot(coefs, r->x + c*r->size + start, b->taps);
+        done++;
+        r->out_total++;
+
+        r->phase += b->down;
+        r->next  += r->phase/b->up;
+        r->phase %= b->up;
+    }
+
+    return done;
+}
+
+// Appends n planar samples per channel, stride apart, after dropping the pairs no output needs
+static void stage_append(Stage *st, int channels, const float *src, size_t stride, size_t n)
+{
+    const int half = st->bank->taps/2;
+    const size_t drop = st->next-half-st->base;
+    size_t k = 0;
+    int pending = st->pending;
+
+    for (int c = 0; c < channels; c++) {
+        float *even = st->even + c*st->size, *odd = st->odd + c*st->size;
+        const float *x = src + c*stride;
+        size_t i = 0;
+
+        memmove(even, even+drop, (st->pairs-drop+st->pending)*sizeof(float));
+        memmove(odd, odd+drop, (st->pairs-drop)*sizeof(float));
+        k = st->pairs-drop;
+        pending = st->pending;
+        if (pending && n) {
+            odd[k++] = x[i++];
+            pending = 0;
+        }
+        for (; i + 2 <= n; i += 2, k++) {
+            even[k] = x[i];
+            odd[k]  = x[i+1];
+        }
+        if (i < n) {
+            even[k] = x[i];
+            pending = 1;
+        }
+    }
+    st->base   += drop;
+    st->pairs   = k;
+    st->pending = pending;
+}
+
+// Decimates all it can into dst, planar and stride apart, returns the frames written
+static size_t stage_run(Stage *st, int channels, float *dst, size_t stride)
+{
+    const int half = st->bank->taps/2;
+    size_t n = 0;
+
+    if (st->next+half > st->base + (int64_t)st->pairs)
+        return 0;
+    n = st->base + st->pairs - (st->next+half) + 1;
+    for (int c = 0; c < channels; c++) {
+        const float *even = st->even + c*st->size + (st->next-st->base);
+        const float *odd  = st->odd + c*st->size + (st->next-half-st->base);
+
+        for (size_t i = 0; i < n; i++)
+            dst[c*stride + i] = 0.5f*even[i] + dot(st->bank->coefs, odd+i, st->bank->taps);
+    }
+    st->next += n;
+
+    return n;
+}
+
+static size_t output_halfband(Resampler *r, float *out, size_t olen)
+{
+    size_t done = 0;
+
+    if (!r->fn)
+        return 0;
+
+    while (done < olen) {
+        uint64_t total = (r->in_total + ((uint64_t)1 << r->stages) - 1) >> r->stages;
+        soxr_in_t data = NULL;
+        size_t n;
+
+        if (r->ready_pos < r->ready_len) {
+            size_t take = r->ready_len-r->ready_pos;
+            if (take > olen-done)
+                take = olen-done;
+            if (r->eof && take > total-r->out_total)
+                take = total-r->out_total;
+            if (!take)
+                break; // Everything flushed
+            for (size_t i = 0; i < take; i++)
+                for (int c = 0; c < r->channels; c++)
+                    out[(done+i)*r->channels + c] = r->ready[c*r->stage[r->stages-1].size + r->ready_pos+i];
+            r->ready_pos += take;
+            r->out_total += take;
+            done += take;
+            continue;
+        }
+        if (r->eof == 2)
+            break;
+
+        if (r->eof) { // Silence to flush every stage with
+            n = r->block_size;
+            r->eof = 2;
+        } else {
+            n = r->fn(r->state, &data, r->block_size < r->max_ilen ? r->block_size : r->max_ilen);
+            r->eof = !n || !data;
+            if (r->eof)
+                continue;
+            r->in_total += n;
+        }
+        to_planar(r, r->block, r->block_size, data, n);
+
+        for (int i = 0; i < r->stages; i++) {
+            Stage *st = &r->stage[i];
+            float *dst = i+1 < r->stages ? r->block : r->ready;
+            size_t stride = i+1 < r->stages ? r->block_size : st->size;
+
+            stage_append(st, r->channels, r->block, r->block_size, n);
+            n = stage_run(st, r->channels, dst, stride);
+        }
+        r->ready_len = n;
+        r->ready_pos = 0;
+    }
+
+    return done;
+}
+
+size_t vac_resample_output(Resampler *r, float *out, size_t olen)
+{
+    return r->stages ? output_halfband(r, out, olen) : output_polyphase(r, out, olen);
+}
+
+void vac_resample_delete(Resampler *r)
+{
+    if (!r)
+        return;
+    free(r->x);
+    free(r->block);
+    free(r);
+}
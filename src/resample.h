@@ -0,0 +1,57 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VAC_RESAMPLE_H
+#define VAC_RESAMPLE_H
+
+#include <stddef.h>
+
+#include <soxr.h>
+
+typedef struct Resampler Resampler;
+
+/*
+* Built-in fixed-ratio resamplers to 48 kHz, used in place of soxr for the
+* fast and balanced presets. They have not been timed against soxr at the
+* same attenuation. Common rates up to 192 kHz, like the 44.1 kHz family (147:160)
+* or 16 and 24 kHz speech, go through a polyphase FIR, a windowed sinc with
+* the stopband at the lower Nyquist frequency and precision*6.02 dB of
+* attenuation. 96, 192 and 384 kHz go through a cascade of one to three
+* half-band decimators instead, each of which only computes its odd taps.
+* Filter banks are designed at run time, on first use, rather than generated
+* at build time, and shared by every later instance, so a batch designs each
+* one once. The interface follows soxr's pull model:
+* input comes from fn, in any of soxr's interleaved int16, int32 or float
+* types, and output is interleaved float. NULL is returned for any other
+* ratio, or for a precision beyond what float arithmetic holds.
+*/
+Resampler *vac_resample_create(int in_rate, int channels, soxr_datatype_t itype,
+                               double precision, double passband_end);
+
+// Returns nonzero if the buffers for max_ilen frames can't be allocated
+int vac_resample_set_input_fn(Resampler *r, soxr_input_fn_t fn, void *state, size_t max_ilen);
+
+// Returns fewer than olen frames only once the input is used up and flushed
+size_t vac_resample_output(Resampler *r, float *out, size_t olen);
+
+void vac_resample_delete(Resampler *r);
+
+// Picks the dot product for the CPU, call once before creating any resampler
+void vac_resample_init(void);
+
+#endif
@@ -0,0 +1,116 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef __linux__
+# define _GNU_SOURCE // syscall()
+#endif
+
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef __linux__
+# include <linux/futex.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#elif defined(_WIN32)
+# include <windows.h>
+#endif
+
+#include "ring.h"
+
+static void wait_for_change(uint32_t *word, uint32_t seen)
+{
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+#elif defined(_WIN32)
+    (void)word;
+    (void)seen;
+    Sleep(1);
+#else // No futex, poll instead
+    struct timespec ts = { 0, 100000 };
+    (void)word;
+    (void)seen;
+    nanosleep(&ts, NULL);
+#endif
+}
+
+// Only enters the kernel when the other side has said it is about to sleep
+static void wake(uint32_t *word, const uint32_t *waiting)
+{
+    __atomic_add_fetch(word, 1, __ATOMIC_RELEASE);
+#ifdef __linux__
+    __atomic_thread_fence(__ATOMIC_SEQ_CST); // Pairs with the waiter's flag store and second check
+    if (__atomic_load_n(waiting, __ATOMIC_RELAXED))
+        syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+    (void)waiting;
+#endif
+}
+
+int vac_ring_init(Ring *r, unsigned depth)
+{
+    r->size = 1;
+    while (r->size < depth)
+        r->size <<= 1;
+    r->head = r->tail = r->head_seq = r->tail_seq = 0;
+    r->head_wait = r->tail_wait = 0;
+    r->slot = malloc(r->size*sizeof(*r->slot));
+
+    return !r->slot;
+}
+
+void vac_ring_free(Ring *r)
+{
+    free(r->slot);
+    r->slot = NULL;
+}
+
+void vac_ring_push(Ring *r, void *p)
+{
+    const uint32_t head = r->head;
+
+    while (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= r->size) {
+        uint32_t seq = __atomic_load_n(&r->tail_seq, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&r->tail_wait, 1, __ATOMIC_SEQ_CST);
+        if (head - __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) >= r->size) // Still full now that the flag is up
+            wait_for_change(&r->tail_seq, seq);
+        __atomic_store_n(&r->tail_wait, 0, __ATOMIC_RELAXED);
+    }
+    r->slot[head & (r->size-1)] = p;
+    __atomic_store_n(&r->head, head+1, __ATOMIC_RELEASE);
+    wake(&r->head_seq, &r->head_wait);
+}
+
+void *vac_ring_pop(Ring *r)
+{
+    const uint32_t tail = r->tail;
+    void *p;
+
+    while (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail) {
+        uint32_t seq = __atomic_load_n(&r->head_seq, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&r->head_wait, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&r->head, __ATOMIC_SEQ_CST) == tail) // Still empty now that the flag is up
+            wait_for_change(&r->head_seq, seq);
+        __atomic_store_n(&r->head_wait, 0, __ATOMIC_RELAXED);
+    }
+    p = r->slot[tail & (r->size-1)];
+    __atomic_store_n(&r->tail, tail+1, __ATOMIC_RELEASE);
+    wake(&r->tail_seq, &r->tail_wait);
+
+    return p;
+}
@@ -0,0 +1,53 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VAC_RING_H
+#define VAC_RING_H
+
+#include <stdint.h>
+
+/*
+* Bounded single-producer, single-consumer queue of pointers. head and tail
+* count pushes and pops, each written by one side only with release semantics,
+* so neither side takes a lock. A side that finds the ring full or empty raises
+* its wait flag and sleeps on the other side's sequence word, with a futex on
+* Linux and by polling elsewhere, as shmreader.c does. The other side only makes
+* the wake-up syscall while that flag is raised.
+*/
+typedef struct Ring {
+    void **slot;
+    uint32_t size; // A power of two
+    uint32_t head; // Written by the producer only
+    uint32_t head_seq;
+    uint32_t tail; // Written by the consumer only
+    uint32_t tail_seq;
+    uint32_t head_wait; // The consumer is about to sleep on head_seq
+    uint32_t tail_wait; // The producer is about to sleep on tail_seq
+} Ring;
+
+// Room for at least depth pointers, nonzero on failure
+int vac_ring_init(Ring *r, unsigned depth);
+void vac_ring_free(Ring *r);
+
+// Blocks while the ring is full
+void vac_ring_push(Ring *r, void *p);
+
+// Blocks while the ring is empty
+void *vac_ring_pop(Ring *r);
+
+#endif
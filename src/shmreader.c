@@ -0,0 +1,210 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE // syscall()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shmreader.h"
+
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+# include <linux/futex.h>
+# include <sys/syscall.h>
+#endif
+
+struct shm_reader {
+    vac_shm_header *hdr;
+    unsigned char *data;
+    size_t map_size;
+    unsigned char split[8]; // A sample straddling the end of the ring, put back together
+};
+
+static void wait_for_change(uint32_t *word, uint32_t seen)
+{
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAIT, seen, NULL, NULL, 0);
+#else // No futex, poll instead
+    struct timespec ts = { 0, 1000000 };
+    (void)word;
+    (void)seen;
+    nanosleep(&ts, NULL);
+#endif
+}
+
+static void wake(uint32_t *word)
+{
+    __atomic_add_fetch(word, 1, __ATOMIC_RELEASE);
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+}
+
+void *shm_read_open(const char *name)
+{
+    struct shm_reader *sr;
+    struct stat st;
+    vac_shm_header *hdr;
+    int fd;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*hdr)) {
+        close(fd);
+        return NULL;
+    }
+
+    hdr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED)
+        return NULL;
+
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != VAC_SHM_MAGIC ||
+        hdr->version != VAC_SHM_VERSION ||
+        hdr->capacity < 8 || (hdr->capacity & (hdr->capacity - 1)) ||
+        hdr->data_offset < sizeof(*hdr) || hdr->data_offset % 8 ||
+        hdr->data_offset + hdr->capacity > (uint64_t)st.st_size) {
+        munmap(hdr, st.st_size);
+        return NULL;
+    }
+
+    sr = malloc(sizeof(*sr));
+    if (!sr) {
+        munmap(hdr, st.st_size);
+        return NULL;
+    }
+    sr->hdr      = hdr;
+    sr->data     = (unsigned char *)hdr + hdr->data_offset;
+    sr->map_size = st.st_size;
+
+    return sr;
+}
+
+void shm_read_close(void *obj)
+{
+    struct shm_reader *sr = obj;
+
+    munmap(sr->hdr, sr->map_size);
+    free(sr);
+}
+
+int shm_get_header(void *obj, int *format, int *channels, int *sample_rate, int *bits_per_sample)
+{
+    struct shm_reader *sr = obj;
+
+    *format          = sr->hdr->format;
+    *channels        = sr->hdr->channels;
+    *sample_rate     = sr->hdr->sample_rate;
+    *bits_per_sample = sr->hdr->bits_per_sample;
+
+    return sr->hdr->format && sr->hdr->channels && sr->hdr->sample_rate;
+}
+
+// Points at up to length bytes of whole samples in the mapped ring, blocking until at least one
+// sample is there. Returns NULL once the producer has closed the ring and it has been drained.
+const unsigned char *shm_read_span(void *obj, size_t length, size_t width, size_t *got)
+{
+    struct shm_reader *sr = obj;
+    vac_shm_header *hdr = sr->hdr;
+    const uint64_t mask = hdr->capacity - 1;
+    const uint64_t tail = hdr->tail;
+    uint64_t avail;
+    size_t n, first;
+
+    for (;;) {
+        uint32_t seq = __atomic_load_n(&hdr->head_seq, __ATOMIC_ACQUIRE);
+
+        avail = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE) - tail;
+        if (avail >= width)
+            break;
+        if (__atomic_load_n(&hdr->closed, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE) - tail < width)
+            return NULL; // A partial sample left at the end is dropped
+        wait_for_change(&hdr->head_seq, seq);
+    }
+
+    first = hdr->capacity - (tail & mask);
+    if (first < width) { // Only packed 24-bit samples can be split by the end of the ring
+        memcpy(sr->split, sr->data+(tail & mask), first);
+        memcpy(sr->split+first, sr->data, width-first);
+        *got = width;
+        return sr->split;
+    }
+
+    n = avail < length ? avail : length;
+    if (n > first)
+        n = first; // The rest after wrapping around comes with the next call
+    *got = n - n%width;
+    return sr->data + (tail & mask);
+}
+
+// Hands length bytes from shm_read_span() back to the producer, once they have been converted
+void shm_read_release(void *obj, size_t length)
+{
+    vac_shm_header *hdr = ((struct shm_reader *)obj)->hdr;
+
+    __atomic_store_n(&hdr->tail, hdr->tail + length, __ATOMIC_RELEASE);
+    wake(&hdr->tail_seq); // Producer may be waiting for space
+}
+
+#else
+
+void *shm_read_open(const char *name)
+{
+    (void)name;
+    return NULL;
+}
+
+void shm_read_close(void *obj)
+{
+    (void)obj;
+}
+
+int shm_get_header(void *obj, int *format, int *channels, int *sample_rate, int *bits_per_sample)
+{
+    (void)obj;
+    *format = *channels = *sample_rate = *bits_per_sample = 0;
+    return 0;
+}
+
+const unsigned char *shm_read_span(void *obj, size_t length, size_t width, size_t *got)
+{
+    (void)obj;
+    (void)length;
+    (void)width;
+    *got = 0;
+    return NULL;
+}
+
+void shm_read_release(void *obj, size_t length)
+{
+    (void)obj;
+    (void)length;
+}
+
+#endif
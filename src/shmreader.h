@@ -0,0 +1,78 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VAC_SHMREADER_H
+#define VAC_SHMREADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+* Shared-memory ring buffer written by a capture process and read by vac-enc.
+*
+* The producer creates a POSIX shared-memory object, sizes it to at least
+* data_offset + capacity bytes, fills in the header and stores magic last.
+* data_offset is a multiple of 8 and capacity a power of two of at least 8.
+* Samples are interleaved little-endian PCM laid out as in a WAVE data chunk.
+*
+* head and tail count bytes since the start of the stream, so the ring holds
+* head - tail bytes starting at data[tail % capacity]. The producer copies
+* samples in, stores head with release semantics, increments head_seq and
+* wakes it with FUTEX_WAKE. vac-enc does the same with tail and tail_seq
+* after consuming. Setting closed (then bumping head_seq) ends the stream.
+*
+* vac-enc converts samples straight out of the mapping into its decode
+* buffer and only then moves tail on, so the one copy made is the conversion
+* itself. A 24-bit sample split by the end of the ring is put back together
+* first; no other bytes are staged.
+* Both futex words are shared, so they must not use FUTEX_PRIVATE_FLAG.
+*/
+
+#define VAC_SHM_MAGIC   0x52434156 // "VACR" in memory
+#define VAC_SHM_VERSION 1
+
+typedef struct vac_shm_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sample_rate;
+    uint32_t channels;
+    uint32_t format;          // 1 for integer PCM, 3 for IEEE float, as in WAVE
+    uint32_t bits_per_sample; // 8 (unsigned), 16, 24 (packed), 32 or 64
+    uint64_t capacity;        // Size of the data area in bytes, a power of two
+    uint64_t data_offset;     // Start of the data area, from the start of the object
+    uint8_t  reserved0[24];
+
+    uint64_t head;            // Written by the producer only
+    uint32_t head_seq;
+    uint32_t closed;
+    uint8_t  reserved1[48];
+
+    uint64_t tail;            // Written by the consumer only
+    uint32_t tail_seq;
+    uint32_t reserved2;
+    uint8_t  reserved3[48];
+} vac_shm_header;
+
+void *shm_read_open(const char *name);
+void shm_read_close(void *obj);
+
+int shm_get_header(void *obj, int *format, int *channels, int *sample_rate, int *bits_per_sample);
+const unsigned char *shm_read_span(void *obj, size_t length, size_t width, size_t *got);
+void shm_read_release(void *obj, size_t length);
+
+#endif
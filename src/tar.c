@@ -0,0 +1,289 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "decompress.h"
+#include "tar.h"
+
+#define BLOCK_SIZE 512
+#define MAX_PATH   4096
+
+struct tar_reader {
+    FILE *tar;
+    uint64_t size; // Of the current member, not yet consumed
+    uint64_t pad;
+    int fd;        // Write end of the member pipe
+    pthread_t pump;
+    int pumping;
+    int error;
+    char path[MAX_PATH];
+};
+
+static uint64_t parse_number(const unsigned char *p, int len)
+{
+    uint64_t n = 0;
+
+    if (p[0] & 0x80) { // GNU base-256 for sizes past 8 GiB
+        n = p[0] & 0x3f;
+        for (int i = 1; i < len; i++)
+            n = n << 8 | p[i];
+        return n;
+    }
+    for (int i = 0; i < len && (p[i] == ' ' || (p[i] >= '0' && p[i] <= '7')); i++)
+        if (p[i] != ' ')
+            n = n << 3 | (p[i] - '0');
+    return n;
+}
+
+// Some old archivers summed signed chars, accept either
+static int checksum_ok(const unsigned char *h)
+{
+    const uint64_t expected = parse_number(h+148, 8);
+    unsigned int sum = 8 * ' ';
+    int signed_sum = 8 * ' ';
+
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        if (i < 148 || i >= 156) {
+            sum        += h[i];
+            signed_sum += (signed char)h[i];
+        }
+    }
+    return sum == expected || (uint64_t)signed_sum == expected;
+}
+
+static int skip(FILE *f, uint64_t n)
+{
+    unsigned char buf[4096];
+
+    while (n) {
+        size_t len = n < sizeof(buf) ? n : sizeof(buf);
+        if (fread(buf, 1, len, f) != len)
+            return -1;
+        n -= len;
+    }
+    return 0;
+}
+
+static uint64_t padding(uint64_t size)
+{
+    return (BLOCK_SIZE - size % BLOCK_SIZE) % BLOCK_SIZE;
+}
+
+// Copies the member into the pipe, and keeps reading once the decoder is done so the archive stays in step
+static void *pump_thread(void *arg)
+{
+    struct tar_reader *tr = arg;
+    unsigned char buf[1 << 15];
+    int gone = 0;
+
+    while (tr->size) {
+        size_t len = tr->size < sizeof(buf) ? tr->size : sizeof(buf);
+        len = fread(buf, 1, len, tr->tar);
+        if (!len)
+            break;
+        tr->size -= len;
+        if (!gone && vac_pipe_write(tr->fd, buf, len))
+            gone = 1;
+    }
+    vac_pipe_close(tr->fd);
+
+    return NULL;
+}
+
+void *tar_read_open(FILE *tar)
+{
+    struct tar_reader *tr = malloc(sizeof(*tr));
+
+    if (!tr)
+        return NULL;
+    memset(tr, 0, sizeof(*tr));
+    tr->tar = tar;
+
+    return tr;
+}
+
+int tar_read_close(void *obj)
+{
+    struct tar_reader *tr = obj;
+    int error = tr->error;
+
+    if (tr->pumping)
+        pthread_join(tr->pump, NULL);
+    if (tr->tar != stdin)
+        fclose(tr->tar);
+    free(tr);
+
+    return error;
+}
+
+// Takes the path from a pax extended header, if it has one
+static void parse_pax(char *path, const char *rec, uint64_t len)
+{
+    const char *end = rec + len;
+
+    while (rec < end) {
+        char *eq;
+        long n = strtol(rec, &eq, 10);
+        if (n <= 0 || n > end - rec)
+            return;
+        eq = strchr(eq, ' ');
+        if (eq && !strncmp(eq+1, "path=", 5) && eq+6 < rec+n) {
+            size_t plen = rec + n - 1 - (eq+6);
+            if (plen < MAX_PATH) {
+                memcpy(path, eq+6, plen);
+                path[plen] = '\0';
+            }
+        }
+        rec += n;
+    }
+}
+
+const char *tar_read_next(void *obj, uint64_t *size)
+{
+    struct tar_reader *tr = obj;
+    unsigned char h[BLOCK_SIZE];
+    char long_path[MAX_PATH] = "";
+
+    if (tr->pumping) {
+        pthread_join(tr->pump, NULL);
+        tr->pumping = 0;
+    }
+    if (skip(tr->tar, tr->size + tr->pad)) {
+        tr->error = 1;
+        return NULL;
+    }
+    tr->size = tr->pad = 0;
+
+    while (fread(h, 1, BLOCK_SIZE, tr->tar) == BLOCK_SIZE) {
+        uint64_t len = parse_number(h+124, 12);
+        char type = h[156];
+
+        if (!h[0]) // End of archive
+            return NULL;
+        if (!checksum_ok(h))
+            break;
+
+        if (type == 'L' || type == 'x') { // GNU long name or pax header for the next member
+            char *data = malloc(len+1);
+            if (!data || fread(data, 1, len, tr->tar) != len || skip(tr->tar, padding(len))) {
+                free(data);
+                break;
+            }
+            data[len] = '\0';
+            if (type == 'L' && len < MAX_PATH)
+                strcpy(long_path, data);
+            else if (type == 'x')
+                parse_pax(long_path, data, len);
+            free(data);
+            continue;
+        }
+
+        if (type != '0' && type != '\0' && type != '7') { // Directories, links and the like
+            if (skip(tr->tar, len + padding(len)))
+                break;
+            long_path[0] = '\0';
+            continue;
+        }
+
+        if (long_path[0]) {
+            strcpy(tr->path, long_path);
+        } else if (!memcmp(h+257, "ustar", 5) && h[345]) {
+            snprintf(tr->path, MAX_PATH, "%.155s/%.100s", (char *)h+345, (char *)h);
+        } else {
+            snprintf(tr->path, MAX_PATH, "%.100s", (char *)h);
+        }
+        tr->size = len;
+        tr->pad  = padding(len);
+        *size    = len;
+
+        return tr->path;
+    }
+    tr->error = 1; // Truncated, or not a tar at all
+
+    return NULL;
+}
+
+FILE *tar_member_open(void *obj)
+{
+    struct tar_reader *tr = obj;
+    FILE *member = vac_pipe_open(&tr->fd);
+
+    if (!member)
+        return NULL;
+    if (pthread_create(&tr->pump, NULL, &pump_thread, tr)) {
+        fclose(member);
+        vac_pipe_close(tr->fd);
+        return NULL;
+    }
+    tr->pumping = 1;
+
+    return member;
+}
+
+static int write_header(FILE *tar, const char *path, uint64_t size, char type)
+{
+    unsigned char h[BLOCK_SIZE] = {0};
+    unsigned int sum = 0;
+
+    strncpy((char *)h, path, 100);
+    memcpy(h+100, "0000644", 7);
+    memcpy(h+108, "0000000", 7);
+    memcpy(h+116, "0000000", 7);
+    snprintf((char *)h+124, 12, "%011llo", (unsigned long long)size);
+    snprintf((char *)h+136, 12, "%011llo", (unsigned long long)time(NULL));
+    memset(h+148, ' ', 8);
+    h[156] = type;
+    memcpy(h+257, "ustar", 6);
+    memcpy(h+263, "00", 2);
+
+    for (int i = 0; i < BLOCK_SIZE; i++)
+        sum += h[i];
+    snprintf((char *)h+148, 8, "%06o", sum);
+
+    return fwrite(h, 1, BLOCK_SIZE, tar) != BLOCK_SIZE;
+}
+
+static int write_data(FILE *tar, const void *data, uint64_t size)
+{
+    static const unsigned char zero[BLOCK_SIZE];
+
+    return fwrite(data, 1, size, tar) != size ||
+           fwrite(zero, 1, padding(size), tar) != padding(size);
+}
+
+int tar_write_member(FILE *tar, const char *path, const void *data, uint64_t size)
+{
+    if (strlen(path) >= 100) { // GNU long name, read by every common tar
+        if (write_header(tar, "././@LongLink", strlen(path)+1, 'L') ||
+            write_data(tar, path, strlen(path)+1))
+            return 1;
+    }
+
+    return write_header(tar, path, size, '0') || write_data(tar, data, size);
+}
+
+int tar_write_end(FILE *tar)
+{
+    static const unsigned char zero[2*BLOCK_SIZE];
+
+    return fwrite(zero, 1, sizeof(zero), tar) != sizeof(zero) || fflush(tar);
+}
@@ -0,0 +1,43 @@
+/*
+* vac-enc
+* Copyright (C) 2024 Gianni Rosato
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VAC_TAR_H
+#define VAC_TAR_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+* Sequential tar access, so a whole archive is read or written in one pass.
+* Each member is handed out as a stream of its own, fed through a pipe by a
+* helper thread, which lets vac_open_file() probe and decode it like a file.
+*/
+
+void *tar_read_open(FILE *tar);
+// Nonzero if the archive was cut short or is not a tar
+int tar_read_close(void *obj);
+
+// Skips to the next regular file, returns its path or NULL at the end
+const char *tar_read_next(void *obj, uint64_t *size);
+// The member must be closed with fclose() before calling tar_read_next() again
+FILE *tar_member_open(void *obj);
+
+int tar_write_member(FILE *tar, const char *path, const void *data, uint64_t size);
+int tar_write_end(FILE *tar);
+
+#endif
@@ -27,4 +27,13 @@
 # define argv_utf8 argv
 #endif
 
+// 64-bit file offsets, for inputs over 2 GiB where long is 32 bits
+#if defined WIN32 || defined _WIN32
+# define fseek_64 _fseeki64
+# define ftell_64 _ftelli64
+#else
+# define fseek_64 fseeko // With _FILE_OFFSET_BITS=64 on 32-bit systems
+# define ftell_64 ftello
+#endif
+
 #endif
\ No newline at end of file
@@ -24,11 +24,22 @@
 #include <string.h>
 #include <stdint.h>
 
-#define TAG(a, b, c, d) (((a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+#define TAG(a, b, c, d) (((uint32_t)(a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+
+// The header is parsed from a single read of this size, chunks past it are seeked over
+#define HEADER_BUFFER 65536
+
+// Wave64 chunk GUIDs share these last 12 bytes, the first 4 are the RIFF tag
+static const unsigned char w64_guid[12] = {
+	0xf3, 0xac, 0xd3, 0x11, 0x8c, 0xd1, 0x00, 0xc0, 0x4f, 0x8e, 0xdb, 0x8a
+};
+static const unsigned char w64_riff[16] = {
+	'r', 'i', 'f', 'f', 0x2e, 0x91, 0xcf, 0x11, 0xa5, 0xd6, 0x28, 0xdb, 0x04, 0xc1, 0x00, 0x00
+};
 
 struct wav_reader {
 	FILE *wav;
-	uint32_t data_length;
+	uint64_t data_length;
 
 	int format;
 	int sample_rate;
@@ -38,124 +49,198 @@ struct wav_reader {
 	int block_align;
 
 	int streamed;
+	int seekable;
+	int64_t data_start; // -1 if the samples can't be seeked back to
+	uint64_t data_total;
+
+	// Bytes read ahead while parsing the header, handed out before reading more
+	unsigned char *buf;
+	size_t buf_pos;
+	size_t buf_len;
 };
 
-static uint32_t read_tag(struct wav_reader* wr) {
-	uint32_t tag = 0;
-	tag = (tag << 8) | fgetc(wr->wav);
-	tag = (tag << 8) | fgetc(wr->wav);
-	tag = (tag << 8) | fgetc(wr->wav);
-	tag = (tag << 8) | fgetc(wr->wav);
-	return tag;
+static uint32_t get_tag(const unsigned char *p) {
+	return TAG(p[0], p[1], p[2], p[3]);
 }
 
-static uint32_t read_int32(struct wav_reader* wr) {
-	uint32_t value = 0;
-	value |= fgetc(wr->wav) <<  0;
-	value |= fgetc(wr->wav) <<  8;
-	value |= fgetc(wr->wav) << 16;
-	value |= fgetc(wr->wav) << 24;
-	return value;
+static uint16_t get_int16(const unsigned char *p) {
+	return p[0] | (p[1] << 8);
 }
 
-static uint16_t read_int16(struct wav_reader* wr) {
-	uint16_t value = 0;
-	value |= fgetc(wr->wav) << 0;
-	value |= fgetc(wr->wav) << 8;
-	return value;
+static uint32_t get_int32(const unsigned char *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
 }
 
-static void skip(FILE *f, int n) {
-	int i;
-	for (i = 0; i < n; i++)
-		fgetc(f);
+static uint64_t get_int64(const unsigned char *p) {
+	return get_int32(p) | (uint64_t)get_int32(p + 4) << 32;
 }
 
-void* wav_read_open(const char *filename) {
+// Makes at least n unparsed bytes available in the buffer
+static int fill(struct wav_reader* wr, size_t n) {
+	if (wr->buf_len - wr->buf_pos >= n)
+		return 1;
+	if (n > HEADER_BUFFER)
+		return 0;
+	memmove(wr->buf, wr->buf + wr->buf_pos, wr->buf_len - wr->buf_pos);
+	wr->buf_len -= wr->buf_pos;
+	wr->buf_pos = 0;
+	wr->buf_len += fread(wr->buf + wr->buf_len, 1, HEADER_BUFFER - wr->buf_len, wr->wav);
+	return wr->buf_len >= n;
+}
+
+static int skip(struct wav_reader* wr, uint64_t n) {
+	unsigned char tmp[4096];
+	size_t avail = wr->buf_len - wr->buf_pos;
+	if (n <= avail) {
+		wr->buf_pos += n;
+		return 0;
+	}
+	n -= avail;
+	wr->buf_pos = wr->buf_len = 0;
+	if (wr->seekable)
+		return n > INT64_MAX ? -1 : fseek_64(wr->wav, (int64_t) n, SEEK_CUR);
+	while (n) {
+		size_t len = n < sizeof(tmp) ? n : sizeof(tmp);
+		if (fread(tmp, 1, len, wr->wav) != len)
+			return -1;
+		n -= len;
+	}
+	return 0;
+}
+
+static void parse_fmt(struct wav_reader* wr, const unsigned char *p, uint64_t length) {
+	wr->format          = get_int16(p);
+	wr->channels        = get_int16(p + 2);
+	wr->sample_rate     = get_int32(p + 4);
+	wr->byte_rate       = get_int32(p + 8);
+	wr->block_align     = get_int16(p + 12);
+	wr->bits_per_sample = get_int16(p + 14);
+	if (wr->format == 0xfffe) {
+		if (length < 28)
+			wr->format = 0; // Insufficient data for waveformatex
+		else
+			wr->format = get_int32(p + 24); // First bytes of the subformat GUID
+	}
+}
+
+void* wav_read_open(FILE *wav) {
 	struct wav_reader* wr = (struct wav_reader*) malloc(sizeof(*wr));
-	long data_pos = 0;
+	uint64_t ds64_data_length = 0;
+	int64_t data_pos = -1;
+	int w64, rf64, have_fmt = 0;
+	if (wr == NULL)
+		return NULL;
 	memset(wr, 0, sizeof(*wr));
 
-	if (!strcmp(filename, "-"))
-		wr->wav = stdin;
-	else
-		wr->wav = fopen_utf8(filename, "rb");
-	if (wr->wav == NULL) {
+	wr->wav = wav;
+	wr->data_start = -1;
+	// Pipes can't seek, so stop at the data chunk instead of scanning past it
+	wr->seekable = ftell_64(wav) >= 0;
+	wr->buf = (unsigned char*) malloc(HEADER_BUFFER);
+	if (wr->buf == NULL) {
 		free(wr);
 		return NULL;
 	}
 
-	while (1) {
-		uint32_t tag, tag2, length;
-		tag = read_tag(wr);
-		if (feof(wr->wav))
-			break;
-		length = read_int32(wr);
-		if (!length || length >= 0x7fff0000) {
-			wr->streamed = 1;
-			length = ~0;
-		}
-		if (tag != TAG('R', 'I', 'F', 'F') || length < 4) {
-			fseek(wr->wav, length, SEEK_CUR);
-			continue;
-		}
-		tag2 = read_tag(wr);
-		length -= 4;
-		if (tag2 != TAG('W', 'A', 'V', 'E')) {
-			fseek(wr->wav, length, SEEK_CUR);
-			continue;
+	if (!fill(wr, 12))
+		return wr;
+	w64  = fill(wr, 40) && !memcmp(wr->buf, w64_riff, 16);
+	rf64 = get_tag(wr->buf) == TAG('R', 'F', '6', '4') || get_tag(wr->buf) == TAG('B', 'W', '6', '4');
+	if (w64) {
+		if (get_tag(wr->buf + 24) != TAG('w', 'a', 'v', 'e') || memcmp(wr->buf + 28, w64_guid, 12))
+			return wr;
+		wr->buf_pos = 40;
+	} else {
+		if ((get_tag(wr->buf) != TAG('R', 'I', 'F', 'F') && !rf64) ||
+		    get_tag(wr->buf + 8) != TAG('W', 'A', 'V', 'E'))
+			return wr;
+		wr->buf_pos = 12;
+	}
+
+	// Iterate through the chunks, Wave64 has GUIDs and 64-bit sizes that include the header
+	while (fill(wr, w64 ? 24 : 8)) {
+		const unsigned char *p = wr->buf + wr->buf_pos;
+		uint32_t tag = get_tag(p);
+		uint64_t length, pad;
+		if (w64) {
+			if (memcmp(p + 4, w64_guid, 12))
+				tag = 0;
+			length = get_int64(p + 16);
+			if (length < 24)
+				break;
+			length -= 24;
+			pad = (8 - length % 8) % 8;
+			wr->buf_pos += 24;
+		} else {
+			length = get_int32(p + 4);
+			pad = length & 1;
+			wr->buf_pos += 8;
 		}
-		// RIFF chunk found, iterate through it
-		while (length >= 8) {
-			uint32_t subtag, sublength;
-			subtag = read_tag(wr);
-			if (feof(wr->wav))
+
+		if (tag == TAG('f', 'm', 't', ' ')) {
+			size_t n = length < 40 ? (size_t) length : 40;
+			if (length < 16 || !fill(wr, n)) // Insufficient data for 'fmt '
 				break;
-			sublength = read_int32(wr);
-			length -= 8;
-			if (length < sublength)
+			parse_fmt(wr, wr->buf + wr->buf_pos, length);
+			have_fmt = 1;
+		} else if (tag == TAG('d', 's', '6', '4') && rf64 && !w64) {
+			if (length < 24 || !fill(wr, 24))
 				break;
-			if (subtag == TAG('f', 'm', 't', ' ')) {
-				if (sublength < 16) {
-					// Insufficient data for 'fmt '
-					break;
-				}
-				wr->format          = read_int16(wr);
-				wr->channels        = read_int16(wr);
-				wr->sample_rate     = read_int32(wr);
-				wr->byte_rate       = read_int32(wr);
-				wr->block_align     = read_int16(wr);
-				wr->bits_per_sample = read_int16(wr);
-				if (wr->format == 0xfffe) {
-					if (sublength < 28) {
-						// Insufficient data for waveformatex
-						break;
-					}
-					skip(wr->wav, 8);
-					wr->format = read_int32(wr);
-					skip(wr->wav, sublength - 28);
-				} else {
-					skip(wr->wav, sublength - 16);
-				}
-			} else if (subtag == TAG('d', 'a', 't', 'a')) {
-				data_pos = ftell(wr->wav);
-				wr->data_length = sublength;
-				if (!wr->data_length || wr->streamed) {
-					wr->streamed = 1;
-					return wr;
-				}
-				fseek(wr->wav, sublength, SEEK_CUR);
-			} else {
-				skip(wr->wav, sublength);
+			ds64_data_length = get_int64(wr->buf + wr->buf_pos + 8);
+		} else if (tag == TAG('d', 'a', 't', 'a')) {
+			if (rf64 && length == 0xffffffff)
+				length = ds64_data_length;
+			else if (!w64 && length == 0xffffffff)
+				length = 0;
+			data_pos = wr->seekable ? ftell_64(wr->wav) - (int64_t) (wr->buf_len - wr->buf_pos) : -1;
+			if (length && data_pos >= 0) {
+				// Sizes left over from an interrupted write can run past the end
+				int64_t here = ftell_64(wr->wav), end = -1;
+				if (!fseek_64(wr->wav, 0, SEEK_END))
+					end = ftell_64(wr->wav);
+				fseek_64(wr->wav, here, SEEK_SET);
+				if (end >= data_pos && length > (uint64_t) (end - data_pos))
+					length = end - data_pos;
 			}
-			length -= sublength;
-		}
-		if (length > 0) {
-			// Bad chunk?
-			fseek(wr->wav, length, SEEK_CUR);
+			wr->data_length = wr->data_total = length;
+			if (!length) // Unknown length, read until EOF
+				wr->streamed = 1;
+			if (have_fmt || wr->streamed || !wr->seekable) {
+				wr->data_start = data_pos;
+				return wr; // Samples start right here, possibly already in the buffer
+			}
+			pad = 0;
 		}
+		if (skip(wr, length + pad))
+			break;
+		if (have_fmt && data_pos >= 0)
+			break;
 	}
-	fseek(wr->wav, data_pos, SEEK_SET);
+	// The data chunk came before 'fmt ', go back to it
+	wr->buf_pos = wr->buf_len = 0;
+	if (data_pos >= 0 && have_fmt) {
+		fseek_64(wr->wav, data_pos, SEEK_SET);
+		wr->data_start = data_pos;
+	} else
+		wr->format = 0;
+	return wr;
+}
+
+void* wav_read_open_raw(FILE *wav, int format, int channels, int sample_rate, int bits_per_sample) {
+	struct wav_reader* wr = (struct wav_reader*) malloc(sizeof(*wr));
+	if (wr == NULL)
+		return NULL;
+	memset(wr, 0, sizeof(*wr));
+
+	wr->wav = wav;
+	wr->format = format;
+	wr->channels = channels;
+	wr->sample_rate = sample_rate;
+	wr->bits_per_sample = bits_per_sample;
+	wr->block_align = channels * bits_per_sample / 8;
+	wr->byte_rate = sample_rate * wr->block_align;
+	wr->streamed = 1;
+	wr->data_start = ftell_64(wav);
 	return wr;
 }
 
@@ -163,10 +248,11 @@ void wav_read_close(void* obj) {
 	struct wav_reader* wr = (struct wav_reader*) obj;
 	if (wr->wav != stdin)
 		fclose(wr->wav);
+	free(wr->buf);
 	free(wr);
 }
 
-int wav_get_header(void* obj, int* format, int* channels, int* sample_rate, int* bits_per_sample, unsigned int* data_length) {
+int wav_get_header(void* obj, int* format, int* channels, int* sample_rate, int* bits_per_sample, uint64_t* data_length) {
 	struct wav_reader* wr = (struct wav_reader*) obj;
 	if (format)
 		*format = wr->format;
@@ -177,19 +263,40 @@ int wav_get_header(void* obj, int* format, int* channels, int* sample_rate, int*
 	if (bits_per_sample)
 		*bits_per_sample = wr->bits_per_sample;
 	if (data_length)
-		*data_length = wr->data_length;
+		*data_length = wr->streamed ? 0 : wr->data_length;
 	return wr->format && wr->sample_rate;
 }
 
 int wav_read_data(void* obj, unsigned char* data, unsigned int length) {
 	struct wav_reader* wr = (struct wav_reader*) obj;
-	int n;
+	size_t n = 0;
 	if (wr->wav == NULL)
 		return -1;
 	if (length > wr->data_length && !wr->streamed)
 		length = wr->data_length;
-	n = fread(data, 1, length, wr->wav);
-	wr->data_length -= length;
+	if (wr->buf_pos < wr->buf_len) {
+		n = wr->buf_len - wr->buf_pos;
+		if (n > length)
+			n = length;
+		memcpy(data, wr->buf + wr->buf_pos, n);
+		wr->buf_pos += n;
+	}
+	n += fread(data + n, 1, length - n, wr->wav);
+	wr->data_length -= n;
 	return n;
 }
 
+int wav_seek(void* obj, uint64_t frame) {
+	struct wav_reader* wr = (struct wav_reader*) obj;
+	uint64_t offset = frame * wr->channels * (wr->bits_per_sample / 8);
+	if (wr->data_start < 0)
+		return -1;
+	if (!wr->streamed && offset > wr->data_total)
+		offset = wr->data_total;
+	wr->buf_pos = wr->buf_len = 0;
+	if (fseek_64(wr->wav, wr->data_start, SEEK_SET) || skip(wr, offset))
+		return -1;
+	if (!wr->streamed)
+		wr->data_length = wr->data_total - offset;
+	return 0;
+}
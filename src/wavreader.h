@@ -19,15 +19,20 @@
 #ifndef WAVREADER_H
 #define WAVREADER_H
 
+#include <stdint.h>
+#include <stdio.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-void* wav_read_open(const char *filename);
+void* wav_read_open(FILE *wav);
+void* wav_read_open_raw(FILE *wav, int format, int channels, int sample_rate, int bits_per_sample);
 void wav_read_close(void* obj);
 
-int wav_get_header(void* obj, int* format, int* channels, int* sample_rate, int* bits_per_sample, unsigned int* data_length);
+int wav_get_header(void* obj, int* format, int* channels, int* sample_rate, int* bits_per_sample, uint64_t* data_length);
 int wav_read_data(void* obj, unsigned char* data, unsigned int length);
+int wav_seek(void* obj, uint64_t frame);
 
 #ifdef __cplusplus
 }